@@ -0,0 +1,29 @@
+#version 330 core
+
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec3 inNormal;
+layout (location = 2) in vec2 inTexCoord;
+// per instance
+layout (location = 3) in vec3 inInstancePosition;
+layout (location = 4) in vec3 inInstanceScale;
+
+uniform mat4 projection;
+uniform mat4 view;
+
+// per part, same transform as WorldObject::render
+uniform vec3 partOffset;
+uniform vec3 partScale;
+
+out vec2 TexCoord;
+out vec3 Position;
+out vec3 Normal;
+
+void main() {
+    vec3 scale = inInstanceScale + partScale;
+    vec3 worldPos = inInstancePosition + partOffset + inPos * scale;
+    TexCoord = inTexCoord;
+    // transpose(inverse(model)) of a translation and scale, as in vs.glsl
+    Normal = inNormal / scale;
+    Position = worldPos;
+    gl_Position = projection * view * vec4(worldPos, 1.0);
+}
@@ -1,7 +1,7 @@
 #version 330 core
 
-uniform sampler2D tex;
-uniform vec2 spriteSheetSize;
+// one sprite per layer, the layer is the sprite's index in the sheet
+uniform sampler2DArray tex;
 
 in vec3 Position;
 in vec2 TexCoord;
@@ -13,9 +13,8 @@ out vec4 color;
 uniform vec3 lightPosition;
 
 void main() {
-    vec2 targetCell = vec2(mod(floor(Index), spriteSheetSize.x), spriteSheetSize.y - floor(Index / spriteSheetSize.y));
-    vec2 targetCellPos = targetCell / spriteSheetSize;
-    vec4 texColor = texture(tex, targetCellPos + vec2(1) * TexCoord / vec2(spriteSheetSize.x, -spriteSheetSize.y));
+    // the layers repeat on their own and have their own mips, nothing bleeds in from neighbouring sprites
+    vec4 texColor = texture(tex, vec3(TexCoord, Index));
 
     if (texColor.a < 0.1) {
         discard;
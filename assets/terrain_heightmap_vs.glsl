@@ -0,0 +1,51 @@
+#version 330 core
+
+layout (location = 0) in uvec2 inLattice;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform mat4 model;
+
+uniform float latticeSpacing;
+uniform float heightScale;
+
+// quantized cell heights, one tile per cell with a one texel apron around the lattice
+uniform isampler2D heightmap;
+// texel of the tile's first (apron) height
+uniform ivec2 tileOrigin;
+
+out vec2 TexCoord;
+out vec3 Position;
+out vec3 Normal;
+flat out float Index;
+
+// tiles are stored with lattice i along rows and j along columns
+float heightAt(int i, int j) {
+    return float(texelFetch(heightmap, tileOrigin + ivec2(j + 1, i + 1), 0).r) * heightScale;
+}
+
+// sprite sheet index by height, same thresholds as getTexture in Terrain.cpp
+float textureIndex(float height) {
+    if (height < 0.0) return 26.0;
+    else if (height < 2.0) return 1.0;
+    else if (height < 4.0) return 2.0;
+    else return 0.0;
+}
+
+void main() {
+    int i = int(inLattice.x);
+    int j = int(inLattice.y);
+    float height = heightAt(i, j);
+    vec3 normal = normalize(vec3(
+        heightAt(i - 1, j) - heightAt(i + 1, j),
+        2.0 * latticeSpacing,
+        heightAt(i, j - 1) - heightAt(i, j + 1)
+    ));
+    vec3 pos = vec3(float(i) * latticeSpacing, height, float(j) * latticeSpacing);
+
+    TexCoord = pos.xz;
+    Index = textureIndex(height);
+    Normal = mat3(transpose(inverse(model))) * normal;
+    Position = (model * vec4(pos, 1.0)).xyz;
+    gl_Position = projection * view * model * vec4(pos, 1.0);
+}
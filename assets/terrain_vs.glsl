@@ -1,23 +1,45 @@
 #version 330 core
 
-layout (location = 0) in vec3 inPos;
-layout (location = 1) in vec3 inNormal;
-layout (location = 2) in vec2 inTexCoord;
-layout (location = 3) in float inTextureIndex;
+layout (location = 0) in uvec2 inLattice;
+layout (location = 1) in vec2 inNormal;
+layout (location = 2) in float inHeight;
+layout (location = 3) in uvec2 inTextureIndex;
 
 uniform mat4 projection;
 uniform mat4 view;
-uniform mat4 model;
+
+// origin of every cell in cells, indexed by the cell's slot in the vertex arena
+uniform isamplerBuffer cellOrigins;
+// vertices per slot, gl_VertexID includes the slot's base vertex
+uniform int slotVertices;
+uniform float cellSize;
+
+uniform float latticeSpacing;
+uniform float heightScale;
 
 out vec2 TexCoord;
 out vec3 Position;
 out vec3 Normal;
 flat out float Index;
 
+// inverse of encodeNormal in Terrain.cpp, octahedron folded around the y axis
+vec3 decodeNormal(vec2 e) {
+    vec3 n = vec3(e.x, 1.0 - abs(e.x) - abs(e.y), e.y);
+    if (n.y < 0.0) {
+        n.xz = (1.0 - abs(n.zx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.z >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
 void main() {
-    TexCoord = inTexCoord;
-    Index = inTextureIndex;
-    Normal = mat3(transpose(inverse(model))) * inNormal;
-    Position = (model * vec4(inPos, 1.0)).xyz;
-    gl_Position = projection * view * model * vec4(inPos, 1.0);
-}
\ No newline at end of file
+    vec3 pos = vec3(vec2(inLattice).x * latticeSpacing, inHeight * heightScale, vec2(inLattice).y * latticeSpacing);
+    ivec2 cell = texelFetch(cellOrigins, gl_VertexID / slotVertices).xy;
+    vec3 origin = vec3(float(cell.x), 0.0, float(cell.y)) * cellSize;
+    // the texture repeats every world unit, terrain_fs.glsl wraps it per fragment
+    TexCoord = pos.xz;
+    Index = float(inTextureIndex.x);
+    // cells are only translated
+    Normal = decodeNormal(inNormal);
+    Position = origin + pos;
+    gl_Position = projection * view * vec4(Position, 1.0);
+}
@@ -0,0 +1,421 @@
+// Microbenchmarks for the terrain generation hot paths. Runs without a display.
+//
+//   bench [--csv] [--out <file>] [--min-time <seconds>] [--seed <seed>]
+//
+// Results are written as JSON (default) or CSV to stdout or the given file so
+// they can be compared across builds.
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Math.h"
+#include "Noise.h"
+#include "TerrainGenerator.h"
+#include "LRUCache.h"
+#include "SpatialIndex.h"
+#include "TerrainEdits.h"
+
+#define BENCH_RENDER_DISTANCE 8 // Same default as the app's TERRAIN_RENDER_DISTANCE.
+#define BENCH_CACHE_CAPACITY 512 // Same default as the app's TERRAIN_CACHE_CAPACITY.
+
+struct BenchResult {
+    std::string name;
+    long long iterations;
+    double seconds;
+    // items processed per second, see unit
+    double rate;
+    std::string unit;
+};
+
+struct CacheResult {
+    std::string path;
+    size_t capacity;
+    int frames;
+    CacheStats stats;
+};
+
+// keeps results alive so the optimizer can't drop the work
+static volatile float sink;
+
+// Runs body repeatedly until minTime has passed. body returns how many items it processed.
+static BenchResult run(const std::string& name, const std::string& unit, double minTime, const std::function<long long()>& body) {
+    using clock = std::chrono::steady_clock;
+    long long iterations = 0;
+    long long items = 0;
+    auto start = clock::now();
+    double elapsed = 0;
+    while (elapsed < minTime) {
+        items += body();
+        iterations++;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    }
+    return BenchResult{name, iterations, elapsed, items / elapsed, unit};
+}
+
+static void benchNoise(std::vector<BenchResult>& results, double minTime, int seed) {
+    const int n = 256;
+    results.push_back(run("noise_scalar", "samples/s", minTime, [&]() {
+        float sum = 0;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                sum += math::getPerlinNoise(i * 0.013f, j * 0.017f, seed);
+            }
+        }
+        sink = sum;
+        return static_cast<long long>(n) * n;
+    }));
+    std::vector<float> grid(n * n);
+    math::SimdLevel levels[] = {math::SimdLevel::SCALAR, math::SimdLevel::SSE4, math::SimdLevel::AVX2};
+    for (math::SimdLevel level : levels) {
+        if (level > math::getSimdLevel()) {
+            continue;
+        }
+        results.push_back(run(std::string("noise_grid_") + math::getSimdLevelName(level), "samples/s", minTime, [&]() {
+            math::getPerlinNoiseGrid(grid.data(), n, 0.0f, 0.0f, 0.013f, 0.017f, n, n, seed, level);
+            sink = grid[n * n / 2];
+            return static_cast<long long>(n) * n;
+        }));
+    }
+    results.push_back(run("noise_grid_shared", "samples/s", minTime, [&]() {
+        math::getPerlinNoiseGridShared(grid.data(), n, 0.0f, 0.0f, 0.013f, 0.017f, n, n, seed);
+        sink = grid[n * n / 2];
+        return static_cast<long long>(n) * n;
+    }));
+    const math::PermutationTable& table = math::getPermutationTable(seed);
+    results.push_back(run("noise_table_scalar", "samples/s", minTime, [&]() {
+        float sum = 0;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                sum += table.getNoise(i * 0.013f, j * 0.017f);
+            }
+        }
+        sink = sum;
+        return static_cast<long long>(n) * n;
+    }));
+    results.push_back(run("noise_table_grid", "samples/s", minTime, [&]() {
+        table.getNoiseGrid(grid.data(), n, 0.0f, 0.0f, 0.013f, 0.017f, n, n);
+        sink = grid[n * n / 2];
+        return static_cast<long long>(n) * n;
+    }));
+    // building a table for a fresh seed every time
+    unsigned int nextSeed = 0;
+    results.push_back(run("noise_table_setup", "tables/s", minTime, [&]() {
+        math::PermutationTable fresh(nextSeed++);
+        sink = fresh.getNoise(0.5f, 0.5f);
+        return 1LL;
+    }));
+}
+
+static void benchCells(std::vector<BenchResult>& results, double minTime, int seed) {
+    // walk over fresh cells so nothing is reused between iterations
+    int next = 0;
+    std::vector<float> apron(TERRAIN_HEIGHTMAP_SIZE * TERRAIN_HEIGHTMAP_SIZE);
+    results.push_back(run("cell_lattice", "cells/s", minTime, [&]() {
+        terraingen::generateLattice(apron.data(), next % 1024, next / 1024, seed);
+        next++;
+        sink = apron[0];
+        return 1LL;
+    }));
+    next = 0;
+    results.push_back(run("cell_lattice_mesh", "cells/s", minTime, [&]() {
+        TerrainCellData cell = terraingen::generateCell(next % 1024, next / 1024, seed);
+        next++;
+        sink = cell.latticePoints[0][0];
+        return 1LL;
+    }));
+    // the lattice again under every noise preset and backend
+    for (NoiseBackend backend : {NoiseBackend::HASH, NoiseBackend::TABLE}) {
+        terraingen::setNoiseBackend(backend);
+        for (const noise::NoisePreset& preset : noise::getPresets()) {
+            terraingen::setNoisePreset(preset);
+            next = 0;
+            std::string name = std::string("cell_lattice_") + preset.name + "_" + noise::getBackendName(backend);
+            results.push_back(run(name, "cells/s", minTime, [&]() {
+                terraingen::generateLattice(apron.data(), next % 1024, next / 1024, seed);
+                next++;
+                sink = apron[0];
+                return 1LL;
+            }));
+        }
+    }
+    terraingen::setNoiseBackend(NoiseBackend::HASH);
+    terraingen::setNoisePreset(noise::getDefaultPreset());
+}
+
+static void benchHeightQueries(std::vector<BenchResult>& results, double minTime, int seed) {
+    // a block of resident cells, queries inside it hit and queries elsewhere miss
+    const int block = 16;
+    const float origin = 1000.0f;
+    const int originCell = static_cast<int>(origin / TERRAIN_CELL_SIZE);
+    LRUCache<CellKey, TerrainCellData, CellKeyHash> cells(block * block);
+    for (int cx = 0; cx < block; cx++) {
+        for (int cz = 0; cz < block; cz++) {
+            cells.put(CellKey{originCell + cx, originCell + cz}, terraingen::generateCell(originCell + cx, originCell + cz, seed));
+        }
+    }
+    const int numQueries = 4096;
+    std::vector<float> hitX(numQueries), hitZ(numQueries), missX(numQueries), missZ(numQueries);
+    // the same query points on every run
+    math::RandomStream random(seed, 0, 0, 0);
+    for (int i = 0; i < numQueries; i++) {
+        hitX[i] = originCell * TERRAIN_CELL_SIZE + random.getFloat(i * 4, 0, block * TERRAIN_CELL_SIZE - 0.01f);
+        hitZ[i] = originCell * TERRAIN_CELL_SIZE + random.getFloat(i * 4 + 1, 0, block * TERRAIN_CELL_SIZE - 0.01f);
+        missX[i] = random.getFloat(i * 4 + 2, 5000, 6000);
+        missZ[i] = random.getFloat(i * 4 + 3, 5000, 6000);
+    }
+    // the same lookup Terrain::getHeight does, falling back to the noise on a miss
+    auto getHeight = [&](float x, float z) {
+        auto cell = cells.get(terraingen::getCellKey(x, z));
+        if (cell != nullptr) {
+            return terraingen::getHeight(*cell, x, z);
+        }
+        return terraingen::getNoiseHeight(x, z, seed);
+    };
+    results.push_back(run("height_query_hit", "queries/s", minTime, [&]() {
+        float sum = 0;
+        for (int i = 0; i < numQueries; i++) {
+            sum += getHeight(hitX[i], hitZ[i]);
+        }
+        sink = sum;
+        return static_cast<long long>(numQueries);
+    }));
+    results.push_back(run("height_query_miss", "queries/s", minTime, [&]() {
+        float sum = 0;
+        for (int i = 0; i < numQueries; i++) {
+            sum += getHeight(missX[i], missZ[i]);
+        }
+        sink = sum;
+        return static_cast<long long>(numQueries);
+    }));
+}
+
+static void benchObjectQueries(std::vector<BenchResult>& results, double minTime, int seed) {
+    // the objects of a block of cells, boxed like the app's tree model
+    const int block = 32;
+    SpatialIndex<int> index;
+    for (int cx = 0; cx < block; cx++) {
+        for (int cz = 0; cz < block; cz++) {
+            std::vector<SpatialIndex<int>::Entry> entries;
+            for (const ObjectPlacement& object : terraingen::generateCell(cx, cz, seed).objects) {
+                entries.push_back(SpatialIndex<int>::Entry{object.pos + glm::vec3(-2, -0.5f, -2), object.pos + glm::vec3(2, 8.5f, 2), 0});
+            }
+            index.insertCell(CellKey{cx, cz}, entries);
+        }
+    }
+    const int numQueries = 4096;
+    const float extent = block * TERRAIN_CELL_SIZE;
+    std::vector<glm::vec3> points(numQueries), motions(numQueries);
+    math::RandomStream random(seed, 1, 0, 0);
+    for (int i = 0; i < numQueries; i++) {
+        float x = random.getFloat(i * 4, 0, extent), z = random.getFloat(i * 4 + 1, 0, extent);
+        points[i] = glm::vec3(x, terraingen::getNoiseHeight(x, z, seed) + 1, z);
+        // a tenth of a second at running speed
+        float angle = random.getFloat(i * 4 + 2, 0, 6.2831853f);
+        motions[i] = glm::vec3(std::cos(angle), 0, std::sin(angle)) * 0.5f;
+    }
+    results.push_back(run("object_query_radius", "queries/s", minTime, [&]() {
+        int found = 0;
+        for (const glm::vec3& point : points) {
+            index.queryRadius(point, 5.0f, [&](const SpatialIndex<int>::Entry&) { found++; });
+        }
+        sink = static_cast<float>(found);
+        return static_cast<long long>(numQueries);
+    }));
+    results.push_back(run("object_query_nearest", "queries/s", minTime, [&]() {
+        int found = 0;
+        for (const glm::vec3& point : points) {
+            found += index.findNearest(point, 32.0f) != nullptr;
+        }
+        sink = static_cast<float>(found);
+        return static_cast<long long>(numQueries);
+    }));
+    results.push_back(run("object_query_sweep", "queries/s", minTime, [&]() {
+        int hits = 0;
+        SpatialIndex<int>::SweepHit hit;
+        for (int i = 0; i < numQueries; i++) {
+            hits += index.sweepCapsule(points[i], 1.6f, 0.3f, motions[i], hit);
+        }
+        sink = static_cast<float>(hits);
+        return static_cast<long long>(numQueries);
+    }));
+}
+
+// The CPU side of a brush stroke as Terrain::edit does it: the edit itself and rebuilding
+// the changed vertices. The cells are edited once beforehand like during sculpting.
+static void benchEdits(std::vector<BenchResult>& results, double minTime, int seed) {
+    TerrainEdits edits(seed);
+    const int numStrokes = 256;
+    std::vector<TerrainBrush> strokes(numStrokes);
+    math::RandomStream random(seed, 2, 0, 0);
+    for (int i = 0; i < numStrokes; i++) {
+        TerrainBrush& brush = strokes[i];
+        brush.mode = static_cast<TerrainBrushMode>(i % 3);
+        brush.x = random.getFloat(i * 2, 0, 4 * TERRAIN_CELL_SIZE);
+        brush.z = random.getFloat(i * 2 + 1, 0, 4 * TERRAIN_CELL_SIZE);
+        brush.radius = 3.0f;
+        brush.strength = 0.05f;
+        brush.target = 2.0f;
+    }
+    std::vector<TerrainEditRegion> changed;
+    for (const TerrainBrush& brush : strokes) {
+        edits.apply(brush, changed);
+    }
+    std::vector<TerrainVertex> vertices((TERRAIN_POINTS_PER_CELL + 1) * (TERRAIN_POINTS_PER_CELL + 1));
+    results.push_back(run("terrain_edit_stroke", "strokes/s", minTime, [&]() {
+        int rebuilt = 0;
+        for (const TerrainBrush& brush : strokes) {
+            changed.clear();
+            edits.apply(brush, changed);
+            for (const TerrainEditRegion& region : changed) {
+                const float* apron = edits.find(region.key);
+                for (int i = std::max(region.i0 - 2, 0); i <= std::min(region.i1, TERRAIN_POINTS_PER_CELL); i++) {
+                    for (int j = std::max(region.j0 - 2, 0); j <= std::min(region.j1, TERRAIN_POINTS_PER_CELL); j++) {
+                        vertices[i * (TERRAIN_POINTS_PER_CELL + 1) + j] = terraingen::buildVertex(apron, i, j);
+                        rebuilt++;
+                    }
+                }
+            }
+        }
+        sink = static_cast<float>(rebuilt);
+        return static_cast<long long>(numStrokes);
+    }));
+}
+
+// Replays a camera path through a cell cache the way Terrain::render touches it:
+// every frame each cell in the render window is looked up and generated on a miss.
+static CacheResult replayPath(const std::string& name, size_t capacity, int frames, const std::function<void(int, float&, float&)>& path) {
+    LRUCache<CellKey, int, CellKeyHash> cache(capacity);
+    const int r = BENCH_RENDER_DISTANCE;
+    for (int frame = 0; frame < frames; frame++) {
+        float x, z;
+        path(frame, x, z);
+        CellKey cameraCell = terraingen::getCellKey(x, z);
+        for (int cx = cameraCell.x - r; cx <= cameraCell.x + r; cx++) {
+            for (int cz = cameraCell.z - r; cz <= cameraCell.z + r; cz++) {
+                if (cache.get(CellKey{cx, cz}) == nullptr) {
+                    cache.put(CellKey{cx, cz}, 0);
+                }
+            }
+        }
+    }
+    return CacheResult{name, capacity, frames, cache.getStats()};
+}
+
+static void benchCachePaths(std::vector<CacheResult>& results) {
+    // paths at 60 frames per second, speeds in units per second
+    const int frames = 60 * 60;
+    const float dt = 1.0f / 60.0f;
+    const size_t window = (2 * BENCH_RENDER_DISTANCE + 1) * (2 * BENCH_RENDER_DISTANCE + 1);
+    size_t capacities[] = {window, BENCH_CACHE_CAPACITY, 4 * BENCH_CACHE_CAPACITY};
+    for (size_t capacity : capacities) {
+        results.push_back(replayPath("straight_walk", capacity, frames, [&](int frame, float& x, float& z) {
+            x = 1000.0f + 5.0f * frame * dt;
+            z = 1000.0f;
+        }));
+        results.push_back(replayPath("straight_fly", capacity, frames, [&](int frame, float& x, float& z) {
+            x = 1000.0f + 50.0f * frame * dt;
+            z = 1000.0f + 20.0f * frame * dt;
+        }));
+        results.push_back(replayPath("circle", capacity, frames, [&](int frame, float& x, float& z) {
+            float angle = 0.1f * frame * dt;
+            x = 1000.0f + 100.0f * std::cos(angle);
+            z = 1000.0f + 100.0f * std::sin(angle);
+        }));
+        results.push_back(replayPath("back_and_forth", capacity, frames, [&](int frame, float& x, float& z) {
+            // 200 units out and back again
+            float t = std::fmod(10.0f * frame * dt, 400.0f);
+            x = 1000.0f + (t < 200.0f ? t : 400.0f - t);
+            z = 1000.0f;
+        }));
+    }
+}
+
+static void writeJson(std::ostream& out, const std::vector<BenchResult>& results, const std::vector<CacheResult>& cacheResults) {
+    out << "{\n";
+    out << "  \"simd\": \"" << math::getSimdLevelName(math::getSimdLevel()) << "\",\n";
+    out << "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+            << ", \"seconds\": " << r.seconds << ", \"rate\": " << r.rate
+            << ", \"unit\": \"" << r.unit << "\"}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ],\n";
+    out << "  \"cache_paths\": [\n";
+    for (size_t i = 0; i < cacheResults.size(); i++) {
+        const CacheResult& r = cacheResults[i];
+        size_t lookups = r.stats.hits + r.stats.misses;
+        out << "    {\"path\": \"" << r.path << "\", \"capacity\": " << r.capacity << ", \"frames\": " << r.frames
+            << ", \"hits\": " << r.stats.hits << ", \"misses\": " << r.stats.misses
+            << ", \"evictions\": " << r.stats.evictions
+            << ", \"hit_rate\": " << (lookups > 0 ? static_cast<double>(r.stats.hits) / lookups : 0.0)
+            << "}" << (i + 1 < cacheResults.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+static void writeCsv(std::ostream& out, const std::vector<BenchResult>& results, const std::vector<CacheResult>& cacheResults) {
+    // one table, cache rows use rate for the hit rate
+    out << "name,iterations,seconds,rate,unit,capacity,hits,misses,evictions\n";
+    for (const BenchResult& r : results) {
+        out << r.name << "," << r.iterations << "," << r.seconds << "," << r.rate << "," << r.unit << ",,,,\n";
+    }
+    for (const CacheResult& r : cacheResults) {
+        size_t lookups = r.stats.hits + r.stats.misses;
+        out << "cache_" << r.path << "," << r.frames << ",," << (lookups > 0 ? static_cast<double>(r.stats.hits) / lookups : 0.0)
+            << ",hit_rate," << r.capacity << "," << r.stats.hits << "," << r.stats.misses << "," << r.stats.evictions << "\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    bool csv = false;
+    std::string outPath;
+    double minTime = 0.5;
+    int seed = 3284;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--csv") {
+            csv = true;
+        } else if (arg == "--out" && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            minTime = std::stod(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::stoi(argv[++i]);
+        } else {
+            std::cerr << "usage: bench [--csv] [--out <file>] [--min-time <seconds>] [--seed <seed>]\n";
+            return 1;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    std::vector<CacheResult> cacheResults;
+    benchNoise(results, minTime, seed);
+    benchCells(results, minTime, seed);
+    benchHeightQueries(results, minTime, seed);
+    benchObjectQueries(results, minTime, seed);
+    benchEdits(results, minTime, seed);
+    benchCachePaths(cacheResults);
+
+    std::ofstream file;
+    if (!outPath.empty()) {
+        file.open(outPath);
+        if (!file) {
+            std::cerr << "could not open " << outPath << "\n";
+            return 1;
+        }
+    }
+    std::ostream& out = outPath.empty() ? std::cout : file;
+    if (csv) {
+        writeCsv(out, results, cacheResults);
+    } else {
+        writeJson(out, results, cacheResults);
+    }
+    return 0;
+}
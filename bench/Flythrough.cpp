@@ -0,0 +1,313 @@
+// Headless render benchmark. Flies the camera along a scripted path over a fixed seed
+// with a fixed timestep and renders every frame into an offscreen framebuffer through
+// EGL, so it runs without a display (on llvmpipe too).
+//
+//   flythrough [--frames <n>] [--warmup <n>] [--width <pixels>] [--height <pixels>]
+//              [--seed <seed>] [--render-distance <cells>] [--heightmap] [--out <file>]
+//
+// Reports CPU and GPU frame time percentiles, cells uploaded and draw calls as JSON on
+// stdout or in the given file. The camera path does not depend on timing, and every frame
+// waits for the cells of its window to be generated and uploads them all before drawing
+// (see Terrain::setWaitForCells), so frame n draws the same scene on every run for a given
+// seed. CPU frame times include that wait, and so how fast the workers generate cells.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Shader.h"
+#include "Texture.h"
+#include "Mesh.h"
+#include "WorldObject.h"
+#include "Frustum.h"
+#include "RenderState.h"
+#include "Terrain.h"
+
+#define FLYTHROUGH_TIMESTEP (1.0f / 60.0f) // Simulated seconds per frame.
+#define FLYTHROUGH_SPEED 12.0f // Camera speed along the path, units per second.
+#define FLYTHROUGH_ALTITUDE 6.0f // Camera height above the terrain.
+#define FLYTHROUGH_QUERY_FRAMES 4 // Frames in flight before the oldest GPU timestamps are read back.
+
+struct FrameTimes {
+    std::vector<double> cpuMs;
+    std::vector<double> gpuMs;
+};
+
+struct Percentiles {
+    double mean = 0, p50 = 0, p90 = 0, p99 = 0, max = 0;
+};
+
+static Percentiles getPercentiles(std::vector<double> values) {
+    Percentiles result;
+    if (values.empty()) {
+        return result;
+    }
+    std::sort(values.begin(), values.end());
+    auto at = [&values](double p) {
+        return values[std::min(static_cast<size_t>(p * values.size()), values.size() - 1)];
+    };
+    for (double value : values) {
+        result.mean += value;
+    }
+    result.mean /= values.size();
+    result.p50 = at(0.5);
+    result.p90 = at(0.9);
+    result.p99 = at(0.99);
+    result.max = values.back();
+    return result;
+}
+
+// A GL 3.3 core context with no surface, on the surfaceless platform where Mesa has it
+static bool createContext() {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (getPlatformDisplay != nullptr) {
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    }
+    if (display == EGL_NO_DISPLAY) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor) || !eglBindAPI(EGL_OPENGL_API)) {
+        return false;
+    }
+    EGLint configAttribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+    EGLConfig config = nullptr;
+    EGLint numConfigs = 0;
+    eglChooseConfig(display, configAttribs, &config, 1, &numConfigs);
+    EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, numConfigs > 0 ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttribs);
+    return context != EGL_NO_CONTEXT && eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+}
+
+// Camera at time t: heads along -z like the app's starting view and weaves from side to
+// side, so new cells keep streaming in and the view turns.
+static void getCamera(Terrain& terrain, float t, glm::vec3& position, glm::vec3& velocity, glm::vec3& forward) {
+    const float weave = 40.0f, frequency = 0.2f;
+    float distance = FLYTHROUGH_SPEED * t;
+    position = glm::vec3(1000.0f + weave * sinf(frequency * t), 0.0f, 1000.0f - distance);
+    glm::vec3 direction(weave * frequency * cosf(frequency * t), 0.0f, -FLYTHROUGH_SPEED);
+    velocity = direction;
+    forward = glm::normalize(direction + glm::vec3(0.0f, -0.25f * glm::length(direction), 0.0f));
+    position.y = std::max(terrain.getHeight(position.x, position.z), 0.0f) + FLYTHROUGH_ALTITUDE;
+}
+
+int main(int argc, char** argv) {
+    int frames = 600;
+    int warmup = 0;
+    int width = 1280, height = 720;
+    int seed = 3284;
+    int renderDistance = TERRAIN_RENDER_DISTANCE;
+    TerrainRenderMode terrainMode = TerrainRenderMode::MESH;
+    std::string outPath;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            frames = std::stoi(argv[++i]);
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            warmup = std::stoi(argv[++i]);
+        } else if (arg == "--width" && i + 1 < argc) {
+            width = std::stoi(argv[++i]);
+        } else if (arg == "--height" && i + 1 < argc) {
+            height = std::stoi(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::stoi(argv[++i]);
+        } else if (arg == "--render-distance" && i + 1 < argc) {
+            renderDistance = std::stoi(argv[++i]);
+        } else if (arg == "--heightmap") {
+            terrainMode = TerrainRenderMode::HEIGHTMAP;
+        } else if (arg == "--out" && i + 1 < argc) {
+            outPath = argv[++i];
+        } else {
+            std::cerr << "usage: flythrough [--frames <n>] [--warmup <n>] [--width <pixels>] [--height <pixels>] "
+                         "[--seed <seed>] [--render-distance <cells>] [--heightmap] [--out <file>]\n";
+            return 1;
+        }
+    }
+
+    if (!createContext() || !gladLoadGLLoader(reinterpret_cast<GLADloadproc>(eglGetProcAddress))) {
+        std::cerr << "flythrough: could not create an offscreen GL 3.3 context\n";
+        return 1;
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto startupBegin = clock::now();
+    shaders::initialize(reinterpret_cast<GLADloadproc>(eglGetProcAddress));
+    meshes::initialize();
+    textures::initialize();
+    models::initialize();
+
+    unsigned int framebuffer, renderbuffers[2];
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glGenRenderbuffers(2, renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+    glViewport(0, 0, width, height);
+
+    glEnable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    Shader waterShader("assets/vs.glsl", "assets/water_fs.glsl");
+    Shader objectShader("assets/vs.glsl", "assets/fs.glsl");
+    Shader instancedShader("assets/instanced_vs.glsl", "assets/fs.glsl");
+    Shader terrainShader(
+        terrainMode == TerrainRenderMode::HEIGHTMAP ? "assets/terrain_heightmap_vs.glsl" : "assets/terrain_vs.glsl",
+        "assets/terrain_fs.glsl"
+    );
+    // link now so startup covers it rather than the first frame
+    terrainShader.use();
+    waterShader.use();
+    objectShader.use();
+    instancedShader.use();
+    glFinish();
+    double startupMs = std::chrono::duration<double, std::milli>(clock::now() - startupBegin).count();
+
+    Terrain terrain(seed, terrainMode);
+    terrain.setRenderDistance(renderDistance);
+    terrain.setWaitForCells(true);
+
+    // GPU time is the difference of timestamps written at the start and end of a frame,
+    // GL_TIME_ELAPSED queries come back wrong on llvmpipe
+    unsigned int queries[FLYTHROUGH_QUERY_FRAMES][2];
+    glGenQueries(FLYTHROUGH_QUERY_FRAMES * 2, &queries[0][0]);
+    FrameTimes times;
+    long long cellsUploaded = 0, drawCalls = 0;
+    int maxPending = 0;
+    auto readQuery = [&](int frame) {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(queries[frame % FLYTHROUGH_QUERY_FRAMES][0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(queries[frame % FLYTHROUGH_QUERY_FRAMES][1], GL_QUERY_RESULT, &end);
+        if (frame >= warmup) {
+            times.gpuMs.push_back((end - begin) / 1e6);
+        }
+    };
+
+    renderstate::beginFrame();
+    auto runBegin = clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        // keep at most FLYTHROUGH_QUERY_FRAMES frames queued, the way a swap chain would
+        if (frame >= FLYTHROUGH_QUERY_FRAMES) {
+            readQuery(frame - FLYTHROUGH_QUERY_FRAMES);
+        }
+        auto frameBegin = clock::now();
+        glQueryCounter(queries[frame % FLYTHROUGH_QUERY_FRAMES][0], GL_TIMESTAMP);
+
+        float t = frame * FLYTHROUGH_TIMESTEP;
+        glm::vec3 cameraPosition, cameraVelocity, cameraForward;
+        getCamera(terrain, t, cameraPosition, cameraVelocity, cameraForward);
+        terrain.setCameraMotion(cameraVelocity, cameraForward);
+
+        // the same passes as the render block of program() in main.cpp
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glm::mat4 proj = glm::perspective(90.0f, width / static_cast<float>(height), 0.1f, 1000.0f);
+        glm::mat4 view = glm::lookAt(cameraPosition, cameraPosition + cameraForward, glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::vec3 lightPos = cameraPosition + glm::vec3(0, 10, 0);
+
+        terrainShader.use();
+        terrainShader.setVec3("lightPosition", lightPos);
+        terrainShader.setMatrix4("projection", proj);
+        terrainShader.setMatrix4("view", view);
+
+        instancedShader.use();
+        instancedShader.setVec3("lightPosition", lightPos);
+        instancedShader.setMatrix4("projection", proj);
+        instancedShader.setMatrix4("view", view);
+
+        terrain.render(terrainShader, instancedShader, cameraPosition.x, cameraPosition.z, Frustum(proj * view));
+
+        // skybox
+        objectShader.use();
+        objectShader.setVec3("lightPosition", lightPos);
+        objectShader.setMatrix4("projection", proj);
+        objectShader.setMatrix4("view", view);
+        glm::mat4 model = glm::scale(glm::translate(glm::mat4(1.0f), cameraPosition), glm::vec3(250.0f, 250.0f, 250.0f));
+        objectShader.setMatrix4("model", model);
+        textures::GALAXY->bind();
+        meshes::CUBE->render();
+
+        // water
+        waterShader.use();
+        waterShader.setMatrix4("projection", proj);
+        waterShader.setMatrix4("view", view);
+        int waterSize = 200;
+        waterShader.setMatrix4("model", glm::scale(
+            glm::translate(glm::mat4(1.0f), glm::vec3(cameraPosition.x - waterSize / 2, 0, cameraPosition.z - waterSize / 2)),
+            glm::vec3(waterSize, 1, waterSize)
+        ));
+        waterShader.setFloat("t", t);
+        meshes::PLANE->render();
+
+        glQueryCounter(queries[frame % FLYTHROUGH_QUERY_FRAMES][1], GL_TIMESTAMP);
+        glFlush();
+        double cpuMs = std::chrono::duration<double, std::milli>(clock::now() - frameBegin).count();
+
+        // closes the frame's counters
+        renderstate::beginFrame();
+        const TerrainRenderStats& terrainStats = terrain.getRenderStats();
+        cellsUploaded += terrainStats.cellsUploaded;
+        maxPending = std::max(maxPending, terrainStats.cellsPending);
+        if (frame >= warmup) {
+            times.cpuMs.push_back(cpuMs);
+            drawCalls += renderstate::getLastFrameStats().drawCalls;
+        }
+    }
+    for (int frame = std::max(frames - FLYTHROUGH_QUERY_FRAMES, 0); frame < frames; frame++) {
+        readQuery(frame);
+    }
+    double runSeconds = std::chrono::duration<double>(clock::now() - runBegin).count();
+    int glError = glGetError();
+    glDeleteQueries(FLYTHROUGH_QUERY_FRAMES * 2, &queries[0][0]);
+
+    std::ofstream file;
+    if (!outPath.empty()) {
+        file.open(outPath);
+        if (!file) {
+            std::cerr << "could not open " << outPath << "\n";
+            return 1;
+        }
+    }
+    std::ostream& out = outPath.empty() ? std::cout : file;
+    auto writePercentiles = [&out](const char* name, const Percentiles& p, bool last) {
+        out << "  \"" << name << "\": {\"mean\": " << p.mean << ", \"p50\": " << p.p50 << ", \"p90\": " << p.p90
+            << ", \"p99\": " << p.p99 << ", \"max\": " << p.max << "}" << (last ? "" : ",") << "\n";
+    };
+    const GLubyte* renderer = glGetString(GL_RENDERER);
+    int measured = static_cast<int>(times.cpuMs.size());
+    out << "{\n";
+    out << "  \"renderer\": \"" << (renderer != nullptr ? reinterpret_cast<const char*>(renderer) : "") << "\",\n";
+    out << "  \"mode\": \"" << (terrainMode == TerrainRenderMode::HEIGHTMAP ? "heightmap" : "mesh") << "\",\n";
+    out << "  \"seed\": " << seed << ", \"render_distance\": " << renderDistance
+        << ", \"width\": " << width << ", \"height\": " << height << ",\n";
+    out << "  \"frames\": " << frames << ", \"warmup\": " << warmup << ", \"timestep\": " << FLYTHROUGH_TIMESTEP << ",\n";
+    out << "  \"startup_ms\": " << startupMs << ", \"run_seconds\": " << runSeconds
+        << ", \"fps\": " << (runSeconds > 0 ? frames / runSeconds : 0.0) << ",\n";
+    out << "  \"cells_uploaded\": " << cellsUploaded << ", \"max_cells_pending\": " << maxPending
+        << ", \"draw_calls_per_frame\": " << (measured > 0 ? static_cast<double>(drawCalls) / measured : 0.0) << ",\n";
+    out << "  \"gl_error\": " << glError << ",\n";
+    writePercentiles("cpu_ms", getPercentiles(times.cpuMs), false);
+    writePercentiles("gpu_ms", getPercentiles(times.gpuMs), true);
+    out << "}\n";
+    return glError == GL_NO_ERROR ? 0 : 1;
+}
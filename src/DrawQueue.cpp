@@ -0,0 +1,38 @@
+#include "DrawQueue.h"
+
+#include <algorithm>
+
+#include "Profiler.h"
+
+void DrawQueue::submit(const Shader& shader, const Texture& texture, const Mesh& mesh, IndexRange range,
+                       std::function<void(const Shader&)> setUniforms) {
+    // GL names are small so 20 bits each for the program and texture leave 24 for the vertex array
+    uint64_t key = static_cast<uint64_t>(shader.getId() & 0xFFFFF) << 44
+                 | static_cast<uint64_t>(texture.getId() & 0xFFFFF) << 24
+                 | static_cast<uint64_t>(mesh.getId() & 0xFFFFFF);
+    commands.push_back(DrawCommand{key, &shader, &texture, &mesh, range, std::move(setUniforms)});
+}
+
+void DrawQueue::execute() {
+    PROFILE_ZONE("DrawQueue::execute");
+    std::stable_sort(commands.begin(), commands.end(), [](const DrawCommand& a, const DrawCommand& b) {
+        return a.key < b.key;
+    });
+    for (const DrawCommand& command : commands) {
+        command.shader->use();
+        command.texture->bind();
+        if (command.setUniforms) {
+            command.setUniforms(*command.shader);
+        }
+        if (command.range.count == 0) {
+            command.mesh->render();
+        } else {
+            command.mesh->render(command.range);
+        }
+    }
+    commands.clear();
+}
+
+size_t DrawQueue::size() const {
+    return commands.size();
+}
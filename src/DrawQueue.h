@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "Shader.h"
+#include "Texture.h"
+#include "Mesh.h"
+
+// One draw of a mesh, or a range of its indices, with a shader and texture.
+struct DrawCommand {
+    // orders commands by shader, then texture, then mesh
+    uint64_t key;
+    const Shader* shader;
+    const Texture* texture;
+    const Mesh* mesh;
+    // count 0 draws the whole mesh
+    IndexRange range;
+    // sets the uniforms specific to this draw, called with the shader in use
+    std::function<void(const Shader&)> setUniforms;
+};
+
+// Collects draws and executes them sorted by their state so consecutive draws
+// share as much of it as possible.
+class DrawQueue {
+private:
+    std::vector<DrawCommand> commands;
+public:
+    void submit(const Shader& shader, const Texture& texture, const Mesh& mesh, IndexRange range,
+                std::function<void(const Shader&)> setUniforms);
+    // sorts and draws everything submitted since the last execute, then clears the queue
+    void execute();
+    size_t size() const;
+};
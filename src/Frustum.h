@@ -0,0 +1,16 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// The six clipping planes of a camera, used to skip drawing things that are off screen.
+class Frustum {
+private:
+    // (normal, distance) pairs facing into the frustum
+    glm::vec4 planes[6];
+public:
+    // extracts the planes from a combined projection * view matrix
+    Frustum(const glm::mat4& viewProjection);
+
+    // conservative test, true if any part of the axis aligned box may be visible
+    bool intersects(const glm::vec3& min, const glm::vec3& max) const;
+};
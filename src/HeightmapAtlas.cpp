@@ -0,0 +1,95 @@
+#include "HeightmapAtlas.h"
+#include "RenderState.h"
+#include "Profiler.h"
+
+#include <cmath>
+
+#include <glad/glad.h>
+
+HeightmapAtlas::HeightmapAtlas(int tileSize, int capacity) : tileSize(tileSize) {
+    reserve(capacity);
+}
+
+HeightmapAtlas::~HeightmapAtlas() {
+    renderstate::forgetTexture(texture);
+    glDeleteTextures(1, &texture);
+}
+
+bool HeightmapAtlas::reserve(int capacity) {
+    if (capacity <= this->capacity) {
+        return false;
+    }
+    int perRow = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(capacity))));
+    int size = perRow * tileSize;
+
+    if (texture == 0) {
+        glGenTextures(1, &texture);
+    }
+    renderstate::bindTexture(0, GL_TEXTURE_2D, texture);
+    // integer textures can't be filtered, the shader reads them with texelFetch
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16I, size, size, 0, GL_RED_INTEGER, GL_SHORT, nullptr);
+    renderstate::bindTexture(0, GL_TEXTURE_2D, 0);
+
+    // new slots go at the back so lower slots are handed out first
+    std::vector<int> added;
+    for (int slot = perRow * perRow - 1; slot >= this->capacity; slot--) {
+        added.push_back(slot);
+    }
+    freeSlots.insert(freeSlots.begin(), added.begin(), added.end());
+    this->capacity = perRow * perRow;
+    tilesPerRow = perRow;
+    return true;
+}
+
+int HeightmapAtlas::allocate() {
+    if (freeSlots.empty()) {
+        return -1;
+    }
+    int slot = freeSlots.back();
+    freeSlots.pop_back();
+    return slot;
+}
+
+void HeightmapAtlas::release(int slot) {
+    freeSlots.push_back(slot);
+}
+
+void HeightmapAtlas::upload(int slot, const short* heights) {
+    PROFILE_ZONE("HeightmapAtlas::upload");
+    PROFILE_COUNTER(ProfileCounter::BYTES_UPLOADED, tileSize * tileSize * sizeof(short));
+    glm::ivec2 origin = getTileOrigin(slot);
+    renderstate::bindTexture(0, GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, origin.x, origin.y, tileSize, tileSize, GL_RED_INTEGER, GL_SHORT, heights);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    renderstate::bindTexture(0, GL_TEXTURE_2D, 0);
+}
+
+void HeightmapAtlas::upload(int slot, const short* heights, int row, int column, int rows, int columns) {
+    PROFILE_ZONE("HeightmapAtlas::upload");
+    PROFILE_COUNTER(ProfileCounter::BYTES_UPLOADED, rows * columns * sizeof(short));
+    glm::ivec2 origin = getTileOrigin(slot);
+    renderstate::bindTexture(0, GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, tileSize);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, origin.x + column, origin.y + row, columns, rows, GL_RED_INTEGER, GL_SHORT, heights + row * tileSize + column);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    renderstate::bindTexture(0, GL_TEXTURE_2D, 0);
+}
+
+glm::ivec2 HeightmapAtlas::getTileOrigin(int slot) const {
+    return glm::ivec2((slot % tilesPerRow) * tileSize, (slot / tilesPerRow) * tileSize);
+}
+
+int HeightmapAtlas::getCapacity() const {
+    return capacity;
+}
+
+void HeightmapAtlas::bind(int unit) const {
+    renderstate::bindTexture(unit, GL_TEXTURE_2D, texture);
+}
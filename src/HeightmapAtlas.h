@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// A single integer texture split into square tiles, one per terrain cell. Each tile
+// holds a cell's quantized height lattice so the terrain vertex shader can displace
+// a shared grid mesh with texelFetch.
+class HeightmapAtlas {
+private:
+    unsigned int texture = 0;
+    int tileSize;
+    int tilesPerRow = 0;
+    int capacity = 0;
+    std::vector<int> freeSlots;
+public:
+    // tileSize is the number of texels along each side of a tile
+    HeightmapAtlas(int tileSize, int capacity);
+    ~HeightmapAtlas();
+
+    HeightmapAtlas(const HeightmapAtlas&) = delete;
+    HeightmapAtlas& operator=(const HeightmapAtlas&) = delete;
+
+    // Reallocates the texture to hold at least capacity tiles. Returns true if it was
+    // reallocated, in which case every tile's contents are lost and must be uploaded again
+    // (slots stay allocated but their origins may move).
+    bool reserve(int capacity);
+
+    // returns a free tile slot or -1 if the atlas is full
+    int allocate();
+    void release(int slot);
+    // uploads tileSize * tileSize heights, row major
+    void upload(int slot, const short* heights);
+    // Uploads only rows row to row + rows - 1 and columns column to column + columns - 1
+    // of the tile. Heights still holds the whole tile.
+    void upload(int slot, const short* heights, int row, int column, int rows, int columns);
+
+    // texel of the first height in the given slot
+    glm::ivec2 getTileOrigin(int slot) const;
+    int getCapacity() const;
+    void bind(int unit) const;
+};
@@ -0,0 +1,83 @@
+#include "InstancedRenderer.h"
+
+#include <glad/glad.h>
+
+#include "Profiler.h"
+#include "RenderState.h"
+
+// per instance attributes, in the locations after the mesh's own ones
+static const VertexAttribSet instanceAttribSet = {
+    {GL_FLOAT, 3, sizeof(float)},  // position
+    {GL_FLOAT, 3, sizeof(float)}   // scale
+};
+
+InstancedRenderer::~InstancedRenderer() {
+    for (auto& entry : batches) {
+        for (unsigned int vao : entry.second.vaos) {
+            renderstate::forgetVertexArray(vao);
+            glDeleteVertexArrays(1, &vao);
+        }
+        glDeleteBuffers(1, &entry.second.vbo);
+    }
+}
+
+void InstancedRenderer::clear() {
+    for (auto& entry : batches) {
+        entry.second.instances.clear();
+    }
+}
+
+void InstancedRenderer::add(const WorldObject& object) {
+    std::vector<float>& instances = batches[&object.model].instances;
+    instances.insert(instances.end(), {
+        object.pos.x, object.pos.y, object.pos.z,
+        object.scale.x, object.scale.y, object.scale.z
+    });
+}
+
+void InstancedRenderer::render(Shader& instancedShader) {
+    PROFILE_ZONE("InstancedRenderer::render");
+    instancedShader.use();
+    for (auto& entry : batches) {
+        const Model& model = *entry.first;
+        Batch& batch = entry.second;
+        if (batch.instances.empty()) {
+            continue;
+        }
+        if (batch.instances != batch.uploaded) {
+            size_t bytes = batch.instances.size() * sizeof(float);
+            if (batch.vbo == 0) {
+                glGenBuffers(1, &batch.vbo);
+                // the instance layout is set once here, reallocating the buffer keeps it
+                for (const auto& part : model) {
+                    batch.vaos.push_back(part->mesh.createInstancedVertexArray(batch.vbo, instanceAttribSet));
+                }
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, batch.vbo);
+            if (bytes > batch.capacity) {
+                // grow with some headroom so small changes don't reallocate
+                batch.capacity = bytes + bytes / 2;
+                glBufferData(GL_ARRAY_BUFFER, batch.capacity, nullptr, GL_DYNAMIC_DRAW);
+            }
+            glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, batch.instances.data());
+            PROFILE_COUNTER(ProfileCounter::BYTES_UPLOADED, bytes);
+            batch.uploaded = batch.instances;
+        }
+        int numInstances = static_cast<int>(batch.instances.size() / 6);
+        for (size_t i = 0; i < model.size(); i++) {
+            const Part& part = *model[i];
+            instancedShader.setVec3("partOffset", part.offsetPosition);
+            instancedShader.setVec3("partScale", part.scale);
+            part.texture.bind();
+            part.mesh.renderInstanced(batch.vaos[i], numInstances);
+        }
+    }
+}
+
+size_t InstancedRenderer::getNumInstances() const {
+    size_t count = 0;
+    for (const auto& entry : batches) {
+        count += entry.second.instances.size() / 6;
+    }
+    return count;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "Mesh.h"
+#include "Shader.h"
+#include "WorldObject.h"
+
+// Draws WorldObjects grouped by Model with one instanced draw per Part.
+// Objects are added every frame; the instance buffer of a model is only
+// re-uploaded when its set of instances changed since the last frame.
+class InstancedRenderer {
+private:
+    struct Batch {
+        // position and scale of every instance, see instanceAttribSet
+        std::vector<float> instances;
+        // what is currently in the buffer
+        std::vector<float> uploaded;
+        unsigned int vbo = 0;
+        size_t capacity = 0;
+        // one per part of the model, its mesh with the instance layout over vbo
+        std::vector<unsigned int> vaos;
+    };
+
+    std::unordered_map<const Model*, Batch> batches;
+public:
+    InstancedRenderer() = default;
+    ~InstancedRenderer();
+
+    InstancedRenderer(const InstancedRenderer&) = delete;
+    InstancedRenderer& operator=(const InstancedRenderer&) = delete;
+
+    // starts collecting a new frame
+    void clear();
+    void add(const WorldObject& object);
+    // Uploads changed batches and draws them. The shader must be built from
+    // instanced_vs.glsl; its projection, view and lighting uniforms must be set.
+    void render(Shader& instancedShader);
+
+    // number of instances added since the last clear
+    size_t getNumInstances() const;
+};
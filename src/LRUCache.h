@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+struct CacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+};
+
+// Map with a bounded number of entries. Once full, inserting evicts the least recently used entry.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class LRUCache {
+private:
+    using Entry = std::pair<K, V>;
+    // most recently used entries are at the front
+    std::list<Entry> entries;
+    std::unordered_map<K, typename std::list<Entry>::iterator, Hash> index;
+    size_t capacity;
+    CacheStats stats;
+    std::function<void(const K&, V&)> onEvict;
+
+    void evictOverflow() {
+        while (entries.size() > capacity) {
+            if (onEvict) {
+                onEvict(entries.back().first, entries.back().second);
+            }
+            index.erase(entries.back().first);
+            entries.pop_back();
+            stats.evictions++;
+        }
+    }
+public:
+    LRUCache(size_t capacity) : capacity(capacity) {}
+
+    // returns the value for key and marks it most recently used, or nullptr on a miss
+    V* get(const K& key) {
+        auto it = index.find(key);
+        if (it == index.end()) {
+            stats.misses++;
+            return nullptr;
+        }
+        stats.hits++;
+        entries.splice(entries.begin(), entries, it->second);
+        return &it->second->second;
+    }
+
+    // looks up key without affecting recency or the counters
+    V* peek(const K& key) {
+        auto it = index.find(key);
+        return it == index.end() ? nullptr : &it->second->second;
+    }
+
+    bool contains(const K& key) const {
+        return index.find(key) != index.end();
+    }
+
+    // inserts or replaces the value for key as the most recently used entry
+    void put(const K& key, V value) {
+        auto it = index.find(key);
+        if (it != index.end()) {
+            it->second->second = std::move(value);
+            entries.splice(entries.begin(), entries, it->second);
+            return;
+        }
+        entries.emplace_front(key, std::move(value));
+        index.emplace(key, entries.begin());
+        evictOverflow();
+    }
+
+    // calls f(key, value) for every entry from most to least recently used
+    template <typename F>
+    void forEach(F f) {
+        for (auto& entry : entries) {
+            f(entry.first, entry.second);
+        }
+    }
+
+    // called with every entry evicted to make room, before it is destroyed
+    void setEvictionCallback(std::function<void(const K&, V&)> callback) {
+        onEvict = std::move(callback);
+    }
+
+    void setCapacity(size_t capacity) {
+        this->capacity = capacity;
+        evictOverflow();
+    }
+
+    size_t getCapacity() const {
+        return capacity;
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    const CacheStats& getStats() const {
+        return stats;
+    }
+};
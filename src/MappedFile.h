@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+
+// A whole file mapped read only. The mapping is released when the object is destroyed
+// and stays valid even if the file is replaced or deleted in the meantime. Others may
+// append to the file while it is mapped, the mapping keeps its original size.
+class MappedFile {
+private:
+    // file and mapping handles on Windows, kept as void* so windows.h stays out of the header
+    void* file = nullptr;
+    void* mapping = nullptr;
+public:
+    const char* data = nullptr;
+    size_t size = 0;
+
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // maps the file, false if it is missing, empty or can't be mapped
+    bool open(const std::string& path);
+};
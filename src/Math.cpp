@@ -1,5 +1,12 @@
 #include "Math.h"
 
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 #include <glm/glm.hpp>
 
 glm::vec2 randomGradient(int ix, int iy, unsigned seed=6482) {
@@ -47,4 +54,587 @@ float math::getPerlinNoise(float x, float y, unsigned int seed) {
     float ix1 = interpolate(n0, n1, sx);
 
     return interpolate(ix0, ix1, sy);
-}
\ No newline at end of file
+}
+
+// Batched grid noise.
+//
+// The SIMD kernels below evaluate exactly the same function as getPerlinNoise
+// (same integer hash, same truncating lattice lookup, same linear blend) for
+// 4 or 8 samples along a grid row at a time. The only deviation is the
+// gradient angle: cos/sin are replaced by a polynomial approximation that is
+// accurate to ~1e-7, so results match the scalar path to within float noise.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MATH_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define MATH_TARGET(isa)
+#else
+#define MATH_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+// Cody-Waite split of pi/2 and minimax coefficients for sin/cos on [-pi/4, pi/4]
+static const float PIO2_1 = 1.5703125f;
+static const float PIO2_2 = 4.837512969970703125e-4f;
+static const float PIO2_3 = 7.549789948768648e-8f;
+static const float SIN_C1 = -1.6666654611e-1f;
+static const float SIN_C2 = 8.3321608736e-3f;
+static const float SIN_C3 = -1.9515295891e-4f;
+static const float COS_C1 = 4.166664568298827e-2f;
+static const float COS_C2 = -1.388731625493765e-3f;
+static const float COS_C3 = 2.443315711809948e-5f;
+// scale applied to the final hash in randomGradient, maps [0, 2^32) to [0, 2*Pi)
+static const float HASH_TO_ANGLE = static_cast<float>(3.14159265 / 2147483648.0);
+
+static void perlinNoiseGridScalar(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny, unsigned int seed) {
+    for (int i = 0; i < nx; i++) {
+        float x = x0 + static_cast<float>(i) * dx;
+        for (int j = 0; j < ny; j++) {
+            out[i * stride + j] = math::getPerlinNoise(x, y0 + static_cast<float>(j) * dy, seed);
+        }
+    }
+}
+
+static void perlinNoisePointsScalar(float* out, const float* xs, const float* ys, int n, unsigned int seed) {
+    for (int k = 0; k < n; k++) {
+        out[k] = math::getPerlinNoise(xs[k], ys[k], seed);
+    }
+}
+
+#ifdef MATH_SIMD_X86
+
+// ---- SSE4.1 (4 lanes) ----
+
+MATH_TARGET("sse4.1")
+static inline __m128i rotl16Sse4(__m128i v) {
+    return _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16));
+}
+
+// returns the gradient angle for lattice points (ix, iy), see randomGradient
+MATH_TARGET("sse4.1")
+static inline __m128 gradientAngleSse4(__m128i ix, __m128i iy) {
+    __m128i a = _mm_mullo_epi32(ix, _mm_set1_epi32(static_cast<int>(3284157443u)));
+    __m128i b = _mm_xor_si128(iy, rotl16Sse4(a));
+    b = _mm_mullo_epi32(b, _mm_set1_epi32(1911520717));
+    a = _mm_xor_si128(a, rotl16Sse4(b));
+    a = _mm_mullo_epi32(a, _mm_set1_epi32(2048419325));
+    // unsigned -> float conversion in two exact halves
+    __m128 hi = _mm_cvtepi32_ps(_mm_srli_epi32(a, 16));
+    __m128 lo = _mm_cvtepi32_ps(_mm_and_si128(a, _mm_set1_epi32(0xFFFF)));
+    __m128 f = _mm_add_ps(_mm_mul_ps(hi, _mm_set1_ps(65536.0f)), lo);
+    return _mm_mul_ps(f, _mm_set1_ps(HASH_TO_ANGLE));
+}
+
+// sin/cos of angles in [0, 2*Pi]
+MATH_TARGET("sse4.1")
+static inline void sinCosSse4(__m128 t, __m128& sinOut, __m128& cosOut) {
+    // shift to [-Pi, Pi] so the quadrant index stays small, undone by the sign flip below
+    __m128 y = _mm_sub_ps(t, _mm_set1_ps(3.14159265f));
+    __m128 qf = _mm_round_ps(_mm_mul_ps(y, _mm_set1_ps(0.63661977236f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m128i q = _mm_cvtps_epi32(qf);
+    __m128 r = _mm_sub_ps(y, _mm_mul_ps(qf, _mm_set1_ps(PIO2_1)));
+    r = _mm_sub_ps(r, _mm_mul_ps(qf, _mm_set1_ps(PIO2_2)));
+    r = _mm_sub_ps(r, _mm_mul_ps(qf, _mm_set1_ps(PIO2_3)));
+    __m128 r2 = _mm_mul_ps(r, r);
+
+    __m128 ps = _mm_add_ps(_mm_set1_ps(SIN_C2), _mm_mul_ps(r2, _mm_set1_ps(SIN_C3)));
+    ps = _mm_add_ps(_mm_set1_ps(SIN_C1), _mm_mul_ps(r2, ps));
+    __m128 s = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), ps));
+
+    __m128 pc = _mm_add_ps(_mm_set1_ps(COS_C2), _mm_mul_ps(r2, _mm_set1_ps(COS_C3)));
+    pc = _mm_add_ps(_mm_set1_ps(COS_C1), _mm_mul_ps(r2, pc));
+    __m128 c = _mm_add_ps(_mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(r2, _mm_set1_ps(0.5f))), _mm_mul_ps(_mm_mul_ps(r2, r2), pc));
+
+    // odd quadrants swap sin and cos
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    __m128 sq = _mm_blendv_ps(s, c, swap);
+    __m128 cq = _mm_blendv_ps(c, s, swap);
+    // sign of sin(t) = -sin(y) and cos(t) = -cos(y) for each quadrant
+    __m128i two = _mm_set1_epi32(2);
+    __m128i sinSign = _mm_slli_epi32(_mm_xor_si128(_mm_and_si128(q, two), two), 30);
+    __m128i cosSign = _mm_slli_epi32(_mm_xor_si128(_mm_and_si128(_mm_add_epi32(q, _mm_set1_epi32(1)), two), two), 30);
+    sinOut = _mm_xor_ps(sq, _mm_castsi128_ps(sinSign));
+    cosOut = _mm_xor_ps(cq, _mm_castsi128_ps(cosSign));
+}
+
+MATH_TARGET("sse4.1")
+static inline __m128 dotGridGradientSse4(__m128i ix, __m128i iy, __m128 dx, __m128 dy) {
+    __m128 s, c;
+    sinCosSse4(gradientAngleSse4(ix, iy), s, c);
+    return _mm_add_ps(_mm_mul_ps(dx, c), _mm_mul_ps(dy, s));
+}
+
+MATH_TARGET("sse4.1")
+static void perlinNoiseGridSse4(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny, unsigned int /* seed, unused like in getPerlinNoise */) {
+    const __m128 laneOffsets = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    alignas(16) float tail[4];
+    for (int i = 0; i < nx; i++) {
+        float x = x0 + static_cast<float>(i) * dx;
+        int ix0 = static_cast<int>(x);
+        float sx = x - static_cast<float>(ix0);
+        __m128i vix0 = _mm_set1_epi32(ix0);
+        __m128i vix1 = _mm_set1_epi32(ix0 + 1);
+        __m128 vdx0 = _mm_set1_ps(sx);
+        __m128 vdx1 = _mm_set1_ps(x - static_cast<float>(ix0 + 1));
+        __m128 vsx = _mm_set1_ps(sx);
+        float* row = out + i * stride;
+        for (int j = 0; j < ny; j += 4) {
+            __m128 fj = _mm_add_ps(_mm_set1_ps(static_cast<float>(j)), laneOffsets);
+            __m128 y = _mm_add_ps(_mm_set1_ps(y0), _mm_mul_ps(fj, _mm_set1_ps(dy)));
+            __m128i iy0 = _mm_cvttps_epi32(y);
+            __m128i iy1 = _mm_add_epi32(iy0, _mm_set1_epi32(1));
+            __m128 sy = _mm_sub_ps(y, _mm_cvtepi32_ps(iy0));
+            __m128 dy1 = _mm_sub_ps(y, _mm_cvtepi32_ps(iy1));
+
+            __m128 n0 = dotGridGradientSse4(vix0, iy0, vdx0, sy);
+            __m128 n1 = dotGridGradientSse4(vix1, iy0, vdx1, sy);
+            __m128 ix0v = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(n1, n0), vsx), n0);
+            n0 = dotGridGradientSse4(vix0, iy1, vdx0, dy1);
+            n1 = dotGridGradientSse4(vix1, iy1, vdx1, dy1);
+            __m128 ix1v = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(n1, n0), vsx), n0);
+            __m128 result = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(ix1v, ix0v), sy), ix0v);
+
+            if (j + 4 <= ny) {
+                _mm_storeu_ps(row + j, result);
+            } else {
+                _mm_store_ps(tail, result);
+                for (int k = 0; j + k < ny; k++) row[j + k] = tail[k];
+            }
+        }
+    }
+}
+
+// same as the grid kernel but every lane has its own x as well
+MATH_TARGET("sse4.1")
+static void perlinNoisePointsSse4(float* out, const float* xs, const float* ys, int n, unsigned int /* seed */) {
+    alignas(16) float tailX[4], tailY[4], tail[4];
+    for (int k = 0; k < n; k += 4) {
+        __m128 x, y;
+        if (k + 4 <= n) {
+            x = _mm_loadu_ps(xs + k);
+            y = _mm_loadu_ps(ys + k);
+        } else {
+            for (int l = 0; l < 4; l++) {
+                tailX[l] = k + l < n ? xs[k + l] : 0.0f;
+                tailY[l] = k + l < n ? ys[k + l] : 0.0f;
+            }
+            x = _mm_load_ps(tailX);
+            y = _mm_load_ps(tailY);
+        }
+        __m128i ix0 = _mm_cvttps_epi32(x);
+        __m128i ix1 = _mm_add_epi32(ix0, _mm_set1_epi32(1));
+        __m128 sx = _mm_sub_ps(x, _mm_cvtepi32_ps(ix0));
+        __m128 dx1 = _mm_sub_ps(x, _mm_cvtepi32_ps(ix1));
+        __m128i iy0 = _mm_cvttps_epi32(y);
+        __m128i iy1 = _mm_add_epi32(iy0, _mm_set1_epi32(1));
+        __m128 sy = _mm_sub_ps(y, _mm_cvtepi32_ps(iy0));
+        __m128 dy1 = _mm_sub_ps(y, _mm_cvtepi32_ps(iy1));
+
+        __m128 n0 = dotGridGradientSse4(ix0, iy0, sx, sy);
+        __m128 n1 = dotGridGradientSse4(ix1, iy0, dx1, sy);
+        __m128 ix0v = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(n1, n0), sx), n0);
+        n0 = dotGridGradientSse4(ix0, iy1, sx, dy1);
+        n1 = dotGridGradientSse4(ix1, iy1, dx1, dy1);
+        __m128 ix1v = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(n1, n0), sx), n0);
+        __m128 result = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(ix1v, ix0v), sy), ix0v);
+
+        if (k + 4 <= n) {
+            _mm_storeu_ps(out + k, result);
+        } else {
+            _mm_store_ps(tail, result);
+            for (int l = 0; k + l < n; l++) out[k + l] = tail[l];
+        }
+    }
+}
+
+// ---- AVX2 (8 lanes) ----
+
+MATH_TARGET("avx2")
+static inline __m256i rotl16Avx2(__m256i v) {
+    return _mm256_or_si256(_mm256_slli_epi32(v, 16), _mm256_srli_epi32(v, 16));
+}
+
+MATH_TARGET("avx2")
+static inline __m256 gradientAngleAvx2(__m256i ix, __m256i iy) {
+    __m256i a = _mm256_mullo_epi32(ix, _mm256_set1_epi32(static_cast<int>(3284157443u)));
+    __m256i b = _mm256_xor_si256(iy, rotl16Avx2(a));
+    b = _mm256_mullo_epi32(b, _mm256_set1_epi32(1911520717));
+    a = _mm256_xor_si256(a, rotl16Avx2(b));
+    a = _mm256_mullo_epi32(a, _mm256_set1_epi32(2048419325));
+    __m256 hi = _mm256_cvtepi32_ps(_mm256_srli_epi32(a, 16));
+    __m256 lo = _mm256_cvtepi32_ps(_mm256_and_si256(a, _mm256_set1_epi32(0xFFFF)));
+    __m256 f = _mm256_add_ps(_mm256_mul_ps(hi, _mm256_set1_ps(65536.0f)), lo);
+    return _mm256_mul_ps(f, _mm256_set1_ps(HASH_TO_ANGLE));
+}
+
+MATH_TARGET("avx2")
+static inline void sinCosAvx2(__m256 t, __m256& sinOut, __m256& cosOut) {
+    __m256 y = _mm256_sub_ps(t, _mm256_set1_ps(3.14159265f));
+    __m256 qf = _mm256_round_ps(_mm256_mul_ps(y, _mm256_set1_ps(0.63661977236f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256i q = _mm256_cvtps_epi32(qf);
+    __m256 r = _mm256_sub_ps(y, _mm256_mul_ps(qf, _mm256_set1_ps(PIO2_1)));
+    r = _mm256_sub_ps(r, _mm256_mul_ps(qf, _mm256_set1_ps(PIO2_2)));
+    r = _mm256_sub_ps(r, _mm256_mul_ps(qf, _mm256_set1_ps(PIO2_3)));
+    __m256 r2 = _mm256_mul_ps(r, r);
+
+    __m256 ps = _mm256_add_ps(_mm256_set1_ps(SIN_C2), _mm256_mul_ps(r2, _mm256_set1_ps(SIN_C3)));
+    ps = _mm256_add_ps(_mm256_set1_ps(SIN_C1), _mm256_mul_ps(r2, ps));
+    __m256 s = _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(r, r2), ps));
+
+    __m256 pc = _mm256_add_ps(_mm256_set1_ps(COS_C2), _mm256_mul_ps(r2, _mm256_set1_ps(COS_C3)));
+    pc = _mm256_add_ps(_mm256_set1_ps(COS_C1), _mm256_mul_ps(r2, pc));
+    __m256 c = _mm256_add_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(r2, _mm256_set1_ps(0.5f))), _mm256_mul_ps(_mm256_mul_ps(r2, r2), pc));
+
+    __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(q, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+    __m256 sq = _mm256_blendv_ps(s, c, swap);
+    __m256 cq = _mm256_blendv_ps(c, s, swap);
+    __m256i two = _mm256_set1_epi32(2);
+    __m256i sinSign = _mm256_slli_epi32(_mm256_xor_si256(_mm256_and_si256(q, two), two), 30);
+    __m256i cosSign = _mm256_slli_epi32(_mm256_xor_si256(_mm256_and_si256(_mm256_add_epi32(q, _mm256_set1_epi32(1)), two), two), 30);
+    sinOut = _mm256_xor_ps(sq, _mm256_castsi256_ps(sinSign));
+    cosOut = _mm256_xor_ps(cq, _mm256_castsi256_ps(cosSign));
+}
+
+MATH_TARGET("avx2")
+static inline __m256 dotGridGradientAvx2(__m256i ix, __m256i iy, __m256 dx, __m256 dy) {
+    __m256 s, c;
+    sinCosAvx2(gradientAngleAvx2(ix, iy), s, c);
+    return _mm256_add_ps(_mm256_mul_ps(dx, c), _mm256_mul_ps(dy, s));
+}
+
+MATH_TARGET("avx2")
+static void perlinNoiseGridAvx2(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny, unsigned int /* seed */) {
+    const __m256 laneOffsets = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+    alignas(32) float tail[8];
+    for (int i = 0; i < nx; i++) {
+        float x = x0 + static_cast<float>(i) * dx;
+        int ix0 = static_cast<int>(x);
+        float sx = x - static_cast<float>(ix0);
+        __m256i vix0 = _mm256_set1_epi32(ix0);
+        __m256i vix1 = _mm256_set1_epi32(ix0 + 1);
+        __m256 vdx0 = _mm256_set1_ps(sx);
+        __m256 vdx1 = _mm256_set1_ps(x - static_cast<float>(ix0 + 1));
+        __m256 vsx = _mm256_set1_ps(sx);
+        float* row = out + i * stride;
+        for (int j = 0; j < ny; j += 8) {
+            __m256 fj = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(j)), laneOffsets);
+            __m256 y = _mm256_add_ps(_mm256_set1_ps(y0), _mm256_mul_ps(fj, _mm256_set1_ps(dy)));
+            __m256i iy0 = _mm256_cvttps_epi32(y);
+            __m256i iy1 = _mm256_add_epi32(iy0, _mm256_set1_epi32(1));
+            __m256 sy = _mm256_sub_ps(y, _mm256_cvtepi32_ps(iy0));
+            __m256 dy1 = _mm256_sub_ps(y, _mm256_cvtepi32_ps(iy1));
+
+            __m256 n0 = dotGridGradientAvx2(vix0, iy0, vdx0, sy);
+            __m256 n1 = dotGridGradientAvx2(vix1, iy0, vdx1, sy);
+            __m256 ix0v = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(n1, n0), vsx), n0);
+            n0 = dotGridGradientAvx2(vix0, iy1, vdx0, dy1);
+            n1 = dotGridGradientAvx2(vix1, iy1, vdx1, dy1);
+            __m256 ix1v = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(n1, n0), vsx), n0);
+            __m256 result = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(ix1v, ix0v), sy), ix0v);
+
+            if (j + 8 <= ny) {
+                _mm256_storeu_ps(row + j, result);
+            } else {
+                _mm256_store_ps(tail, result);
+                for (int k = 0; j + k < ny; k++) row[j + k] = tail[k];
+            }
+        }
+    }
+}
+
+MATH_TARGET("avx2")
+static void perlinNoisePointsAvx2(float* out, const float* xs, const float* ys, int n, unsigned int /* seed */) {
+    alignas(32) float tailX[8], tailY[8], tail[8];
+    for (int k = 0; k < n; k += 8) {
+        __m256 x, y;
+        if (k + 8 <= n) {
+            x = _mm256_loadu_ps(xs + k);
+            y = _mm256_loadu_ps(ys + k);
+        } else {
+            for (int l = 0; l < 8; l++) {
+                tailX[l] = k + l < n ? xs[k + l] : 0.0f;
+                tailY[l] = k + l < n ? ys[k + l] : 0.0f;
+            }
+            x = _mm256_load_ps(tailX);
+            y = _mm256_load_ps(tailY);
+        }
+        __m256i ix0 = _mm256_cvttps_epi32(x);
+        __m256i ix1 = _mm256_add_epi32(ix0, _mm256_set1_epi32(1));
+        __m256 sx = _mm256_sub_ps(x, _mm256_cvtepi32_ps(ix0));
+        __m256 dx1 = _mm256_sub_ps(x, _mm256_cvtepi32_ps(ix1));
+        __m256i iy0 = _mm256_cvttps_epi32(y);
+        __m256i iy1 = _mm256_add_epi32(iy0, _mm256_set1_epi32(1));
+        __m256 sy = _mm256_sub_ps(y, _mm256_cvtepi32_ps(iy0));
+        __m256 dy1 = _mm256_sub_ps(y, _mm256_cvtepi32_ps(iy1));
+
+        __m256 n0 = dotGridGradientAvx2(ix0, iy0, sx, sy);
+        __m256 n1 = dotGridGradientAvx2(ix1, iy0, dx1, sy);
+        __m256 ix0v = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(n1, n0), sx), n0);
+        n0 = dotGridGradientAvx2(ix0, iy1, sx, dy1);
+        n1 = dotGridGradientAvx2(ix1, iy1, dx1, dy1);
+        __m256 ix1v = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(n1, n0), sx), n0);
+        __m256 result = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(ix1v, ix0v), sy), ix0v);
+
+        if (k + 8 <= n) {
+            _mm256_storeu_ps(out + k, result);
+        } else {
+            _mm256_store_ps(tail, result);
+            for (int l = 0; k + l < n; l++) out[k + l] = tail[l];
+        }
+    }
+}
+
+static math::SimdLevel detectSimdLevel() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx2 = false;
+    if (maxLeaf >= 7 && osxsave && (_xgetbv(0) & 0x6) == 0x6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    bool sse41 = __builtin_cpu_supports("sse4.1");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    if (avx2) return math::SimdLevel::AVX2;
+    if (sse41) return math::SimdLevel::SSE4;
+    return math::SimdLevel::SCALAR;
+}
+
+#else
+
+static math::SimdLevel detectSimdLevel() {
+    return math::SimdLevel::SCALAR;
+}
+
+#endif
+
+math::SimdLevel math::getSimdLevel() {
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+const char* math::getSimdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::AVX2: return "avx2";
+        case SimdLevel::SSE4: return "sse4.1";
+        default: return "scalar";
+    }
+}
+
+void math::getPerlinNoiseGrid(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny, unsigned int seed) {
+    getPerlinNoiseGrid(out, stride, x0, y0, dx, dy, nx, ny, seed, getSimdLevel());
+}
+
+void math::getPerlinNoiseGrid(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny, unsigned int seed, SimdLevel level) {
+    if (level > getSimdLevel()) {
+        level = getSimdLevel();
+    }
+#ifdef MATH_SIMD_X86
+    switch (level) {
+        case SimdLevel::AVX2:
+            perlinNoiseGridAvx2(out, stride, x0, y0, dx, dy, nx, ny, seed);
+            return;
+        case SimdLevel::SSE4:
+            perlinNoiseGridSse4(out, stride, x0, y0, dx, dy, nx, ny, seed);
+            return;
+        default:
+            break;
+    }
+#endif
+    perlinNoiseGridScalar(out, stride, x0, y0, dx, dy, nx, ny, seed);
+}
+
+void math::getPerlinNoisePoints(float* out, const float* xs, const float* ys, int n, unsigned int seed) {
+    getPerlinNoisePoints(out, xs, ys, n, seed, getSimdLevel());
+}
+
+void math::getPerlinNoisePoints(float* out, const float* xs, const float* ys, int n, unsigned int seed, SimdLevel level) {
+    if (level > getSimdLevel()) {
+        level = getSimdLevel();
+    }
+#ifdef MATH_SIMD_X86
+    switch (level) {
+        case SimdLevel::AVX2:
+            perlinNoisePointsAvx2(out, xs, ys, n, seed);
+            return;
+        case SimdLevel::SSE4:
+            perlinNoisePointsSse4(out, xs, ys, n, seed);
+            return;
+        default:
+            break;
+    }
+#endif
+    perlinNoisePointsScalar(out, xs, ys, n, seed);
+}
+
+// Shared lattice grid noise.
+//
+// Perlin noise only depends on the gradients at the lattice corners around a sample,
+// and a grid finer than the lattice puts many samples between the same corners. Each
+// corner gradient is computed once into a table, then every grid row is reduced to
+// one linear function a + t * b of the y offset per lattice row, leaving a handful
+// of multiply-adds per sample.
+// gradient(ix, iy) gives the corner gradients and cell(v) the lattice coordinate below v
+template <typename Gradient, typename Cell>
+static void perlinNoiseGridShared(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny, Gradient gradient, Cell cell) {
+    if (nx <= 0 || ny <= 0) {
+        return;
+    }
+    // lattice corners the samples use
+    int ixMin = cell(x0), ixMax = ixMin;
+    for (int i = 0; i < nx; i++) {
+        int ix = cell(x0 + static_cast<float>(i) * dx);
+        ixMin = std::min(ixMin, ix);
+        ixMax = std::max(ixMax, ix);
+    }
+    std::vector<int> iys(ny);
+    std::vector<float> sys(ny);
+    int iyMin = cell(y0), iyMax = iyMin;
+    for (int j = 0; j < ny; j++) {
+        float y = y0 + static_cast<float>(j) * dy;
+        iys[j] = cell(y);
+        sys[j] = y - static_cast<float>(iys[j]);
+        iyMin = std::min(iyMin, iys[j]);
+        iyMax = std::max(iyMax, iys[j]);
+    }
+    const int columns = ixMax - ixMin + 2;
+    const int rows = iyMax - iyMin + 2;
+    std::vector<glm::vec2> gradients(columns * rows);
+    for (int c = 0; c < columns; c++) {
+        for (int r = 0; r < rows; r++) {
+            gradients[c * rows + r] = gradient(ixMin + c, iyMin + r);
+        }
+    }
+    for (int j = 0; j < ny; j++) {
+        iys[j] -= iyMin;
+    }
+
+    std::vector<float> a(rows), b(rows);
+    for (int i = 0; i < nx; i++) {
+        float x = x0 + static_cast<float>(i) * dx;
+        int ix0 = cell(x);
+        float sx = x - static_cast<float>(ix0);
+        const glm::vec2* g0 = &gradients[(ix0 - ixMin) * rows];
+        const glm::vec2* g1 = g0 + rows;
+        // blend of the two corners of each lattice row along x, as a function of y - iy
+        for (int r = 0; r < rows; r++) {
+            float n0 = g0[r].x * sx;
+            float n1 = g1[r].x * (sx - 1.0f);
+            a[r] = n0 + (n1 - n0) * sx;
+            b[r] = g0[r].y + (g1[r].y - g0[r].y) * sx;
+        }
+        float* row = out + i * stride;
+        for (int j = 0; j < ny; j++) {
+            int r = iys[j];
+            float sy = sys[j];
+            float n0 = a[r] + sy * b[r];
+            float n1 = a[r + 1] + (sy - 1.0f) * b[r + 1];
+            row[j] = n0 + (n1 - n0) * sy;
+        }
+    }
+}
+
+void math::getPerlinNoiseGridShared(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny, unsigned int seed) {
+    // truncated like getPerlinNoise does
+    perlinNoiseGridShared(out, stride, x0, y0, dx, dy, nx, ny,
+        [seed](int ix, int iy) { return randomGradient(ix, iy, seed); },
+        [](float v) { return static_cast<int>(v); });
+}
+
+// Permutation table noise.
+//
+// The classic Perlin construction: lattice coordinates are hashed through a shuffled
+// table of 0..255 and the result picks one of a fixed set of gradients, so there is
+// no trig per sample. The blend between corners is the same linear one getPerlinNoise
+// uses so both backends give terrain of the same character.
+
+#define PERMUTATION_GRADIENTS 16 // Unit gradients evenly spread around the circle.
+
+static const glm::vec2* getTableGradients() {
+    static const std::vector<glm::vec2> gradients = []() {
+        std::vector<glm::vec2> result(PERMUTATION_GRADIENTS);
+        for (int i = 0; i < PERMUTATION_GRADIENTS; i++) {
+            double angle = (i + 0.5) * 2 * 3.14159265358979 / PERMUTATION_GRADIENTS;
+            result[i] = glm::vec2(std::cos(angle), std::sin(angle));
+        }
+        return result;
+    }();
+    return gradients.data();
+}
+
+static int floorToInt(float v) {
+    int i = static_cast<int>(v);
+    return i - (static_cast<float>(i) > v);
+}
+
+math::PermutationTable::PermutationTable(unsigned int seed) : seed(seed), gradients(getTableGradients()) {
+    for (int i = 0; i < 256; i++) {
+        perm[i] = static_cast<unsigned char>(i);
+    }
+    // Fisher-Yates shuffle driven by splitmix64
+    unsigned long long state = seed;
+    for (int i = 255; i > 0; i--) {
+        state += 0x9E3779B97F4A7C15ull;
+        int j = static_cast<int>(mix64(state) % static_cast<unsigned long long>(i + 1));
+        std::swap(perm[i], perm[j]);
+    }
+    std::copy(perm, perm + 256, perm + 256);
+}
+
+glm::vec2 math::PermutationTable::getGradient(int ix, int iy) const {
+    return gradients[perm[perm[ix & 255] + (iy & 255)] % PERMUTATION_GRADIENTS];
+}
+
+float math::PermutationTable::getNoise(float x, float y) const {
+    int x0 = floorToInt(x);
+    int y0 = floorToInt(y);
+    float sx = x - static_cast<float>(x0);
+    float sy = y - static_cast<float>(y0);
+    glm::vec2 g00 = getGradient(x0, y0), g10 = getGradient(x0 + 1, y0);
+    glm::vec2 g01 = getGradient(x0, y0 + 1), g11 = getGradient(x0 + 1, y0 + 1);
+    float ix0 = interpolate(g00.x * sx + g00.y * sy, g10.x * (sx - 1) + g10.y * sy, sx);
+    float ix1 = interpolate(g01.x * sx + g01.y * (sy - 1), g11.x * (sx - 1) + g11.y * (sy - 1), sx);
+    return interpolate(ix0, ix1, sy);
+}
+
+void math::PermutationTable::getNoiseGrid(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny) const {
+    perlinNoiseGridShared(out, stride, x0, y0, dx, dy, nx, ny,
+        [this](int ix, int iy) { return getGradient(ix, iy); },
+        floorToInt);
+}
+
+void math::PermutationTable::getNoisePoints(float* out, const float* xs, const float* ys, int n) const {
+    for (int k = 0; k < n; k++) {
+        out[k] = getNoise(xs[k], ys[k]);
+    }
+}
+
+unsigned int math::PermutationTable::getSeed() const {
+    return seed;
+}
+
+const math::PermutationTable& math::getPermutationTable(unsigned int seed) {
+    // the last table each thread used, most callers stick to one seed
+    thread_local const PermutationTable* last = nullptr;
+    if (last != nullptr && last->getSeed() == seed) {
+        return *last;
+    }
+    static std::mutex mutex;
+    static std::unordered_map<unsigned int, std::unique_ptr<PermutationTable>> tables;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<PermutationTable>& table = tables[seed];
+    if (table == nullptr) {
+        table = std::make_unique<PermutationTable>(seed);
+    }
+    last = table.get();
+    return *last;
+}
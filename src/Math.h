@@ -1,6 +1,9 @@
 #pragma once
 
 #include <stdlib.h>
+#include <stddef.h>
+
+#include <glm/glm.hpp>
 
 // defines some useful mathematical utilities
 
@@ -22,5 +25,96 @@ namespace math {
         return (a1 - a0) * w + a0;
     }
 
+    // splitmix64 finalizer, a cheap mix that spreads every input bit over the output
+    inline unsigned long long mix64(unsigned long long z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // Counter based random numbers. The key is a hash of the seed, the cell coordinates
+    // and a stream index, and the n-th number is a hash of the key and n. Nothing depends
+    // on the order numbers are drawn in or on the thread drawing them, so generating in
+    // parallel gives bit-identical results. Use separate streams for unrelated decisions
+    // so adding draws to one doesn't shift the others.
+    class RandomStream {
+    private:
+        unsigned long long key;
+    public:
+        RandomStream(unsigned int seed, int x, int z, unsigned int stream) {
+            key = mix64(seed + 0x9E3779B97F4A7C15ull);
+            key = mix64(key ^ static_cast<unsigned int>(x));
+            key = mix64(key ^ (static_cast<unsigned long long>(static_cast<unsigned int>(z)) << 32));
+            key = mix64(key + stream);
+        }
+
+        // n-th number of the stream
+        unsigned int getUint(unsigned int n) const {
+            return static_cast<unsigned int>(mix64(key + (n + 1ull) * 0x9E3779B97F4A7C15ull) >> 32);
+        }
+
+        // n-th number of the stream in [0, 1)
+        float getFloat(unsigned int n) const {
+            return (getUint(n) >> 8) * (1.0f / 16777216.0f);
+        }
+
+        // n-th number of the stream in [a, b)
+        float getFloat(unsigned int n, float a, float b) const {
+            return getFloat(n) * (b - a) + a;
+        }
+    };
+
     float getPerlinNoise(float x, float y, unsigned int seed);
+
+    // instruction sets the batched noise kernel can run on
+    enum class SimdLevel {
+        SCALAR,
+        SSE4,
+        AVX2
+    };
+
+    // best instruction set supported by this CPU, detected once on first call
+    SimdLevel getSimdLevel();
+    const char* getSimdLevelName(SimdLevel level);
+
+    // Evaluates getPerlinNoise over an axis-aligned grid of samples, writing
+    // the noise at (x0 + i * dx, y0 + j * dy) to out[i * stride + j] for
+    // 0 <= i < nx and 0 <= j < ny. Samples along j are computed in SIMD lanes.
+    void getPerlinNoiseGrid(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny, unsigned int seed);
+    // same as above but forces a specific kernel (falls back to scalar if the CPU lacks it)
+    void getPerlinNoiseGrid(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny, unsigned int seed, SimdLevel level);
+    // Same as getPerlinNoiseGrid but computes each lattice corner's gradient once and shares
+    // it between the samples around it. Much faster when the grid is finer than the noise
+    // lattice (several samples per lattice square along each axis), slower when it's coarser.
+    void getPerlinNoiseGridShared(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny, unsigned int seed);
+    // Evaluates getPerlinNoise at n arbitrary points, out[k] = noise(xs[k], ys[k]).
+    // Slower than the grid version per sample but still runs in SIMD lanes.
+    void getPerlinNoisePoints(float* out, const float* xs, const float* ys, int n, unsigned int seed);
+    // same as above but forces a specific kernel (falls back to scalar if the CPU lacks it)
+    void getPerlinNoisePoints(float* out, const float* xs, const float* ys, int n, unsigned int seed, SimdLevel level);
+
+    // Perlin noise over a permutation table shuffled by the seed, the alternative to the
+    // hash based getPerlinNoise (which doesn't use its seed). Lattice points pick one of
+    // a fixed set of gradients through the table, so sampling needs no trig. Lattice
+    // cells are found by rounding down. Building a table takes about a microsecond.
+    class PermutationTable {
+    private:
+        unsigned int seed;
+        // two copies of the shuffled 0..255 so perm[perm[x] + y] never wraps
+        unsigned char perm[512];
+        const glm::vec2* gradients;
+
+        glm::vec2 getGradient(int ix, int iy) const;
+    public:
+        PermutationTable(unsigned int seed);
+
+        unsigned int getSeed() const;
+        float getNoise(float x, float y) const;
+        // same layout as getPerlinNoiseGrid, shares the corner gradients like getPerlinNoiseGridShared
+        void getNoiseGrid(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny) const;
+        void getNoisePoints(float* out, const float* xs, const float* ys, int n) const;
+    };
+
+    // Table of the seed, built on first use and kept until exit. Thread safe.
+    const PermutationTable& getPermutationTable(unsigned int seed);
 };
\ No newline at end of file
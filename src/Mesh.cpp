@@ -1,39 +1,134 @@
 #include "Mesh.h"
+#include "RenderState.h"
+#include "Profiler.h"
 
 #include <glad/glad.h>
 
 #include <algorithm>
 
-Mesh::Mesh(float* data, int numVertices, const VertexAttribSet& attribSet) {
-    unsigned int vbo;
+IndexBuffer::IndexBuffer(const unsigned short* indices, int numIndices) : numIndices(numIndices) {
+    PROFILE_ZONE("IndexBuffer::IndexBuffer");
+    PROFILE_COUNTER(ProfileCounter::BYTES_UPLOADED, numIndices * sizeof(unsigned short));
+    glGenBuffers(1, &ebo);
+    // the element buffer binding is vertex array state, don't attach it to whatever is bound
+    renderstate::bindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(unsigned short), indices, GL_STATIC_DRAW);
+}
+
+IndexBuffer::~IndexBuffer() {
+    glDeleteBuffers(1, &ebo);
+}
+
+unsigned int IndexBuffer::getId() const {
+    return ebo;
+}
+
+unsigned int IndexBuffer::getNumIndices() const {
+    return numIndices;
+}
+
+static size_t getStride(const VertexAttribSet& attribSet) {
+    size_t stride = 0;
+    std::for_each(attribSet.begin(), attribSet.end(), [&stride](const VertexAttribute& attrib) {
+        stride += attrib.numElements * attrib.sizeOfType;
+    });
+    return stride;
+}
+
+// points the locations from firstLocation on at the buffer bound to GL_ARRAY_BUFFER, in
+// the bound vertex array, advancing once per divisor instances (0 is once per vertex)
+static void setAttributes(const VertexAttribSet& attribSet, unsigned int firstLocation, unsigned int divisor) {
+    size_t stride = getStride(attribSet);
+    size_t byteOffset = 0;
+    for (size_t i = 0; i < attribSet.size(); i++) {
+        const VertexAttribute& attrib = attribSet[i];
+        unsigned int location = firstLocation + i;
+        if (attrib.integer) {
+            glVertexAttribIPointer(location, attrib.numElements, attrib.type, stride, (void*) byteOffset);
+        } else {
+            glVertexAttribPointer(
+                location, 
+                attrib.numElements, 
+                attrib.type, 
+                attrib.normalized ? GL_TRUE : GL_FALSE, 
+                stride, 
+                (void*) byteOffset
+            );
+        }
+        if (divisor != 0) {
+            glVertexAttribDivisor(location, divisor);
+        }
+        byteOffset += attrib.numElements * attrib.sizeOfType;
+        glEnableVertexAttribArray(location);
+    }
+}
+
+Mesh::Mesh(const void* data, int numVertices, const VertexAttribSet& attribSet, const IndexBuffer* indices) : attribSet(attribSet), indices(indices) {
+    PROFILE_ZONE("Mesh::Mesh");
     glGenBuffers(1, &vbo);
     glGenVertexArrays(1, &vao);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBindVertexArray(vao);
-    size_t numElements = 0;
-    std::for_each(attribSet.begin(), attribSet.end(), [&numElements](const VertexAttribute& attrib) {
-        numElements += attrib.numElements;
-    });
-    size_t byteOffset = 0;
-    for (int i = 0; i < attribSet.size(); i++) {
-        glVertexAttribPointer(
-            i, 
-            attribSet[i].numElements, 
-            attribSet[i].type, 
-            GL_FALSE, 
-            numElements * attribSet[i].sizeOfType, 
-            (void*) byteOffset
-        );
-        byteOffset += attribSet[i].numElements * attribSet[i].sizeOfType;
-        glEnableVertexAttribArray(i);
+    renderstate::bindVertexArray(vao);
+    setAttributes(attribSet, 0, 0);
+    size_t stride = getStride(attribSet);
+    glBufferData(GL_ARRAY_BUFFER, stride * numVertices, data, GL_STATIC_DRAW);
+    PROFILE_COUNTER(ProfileCounter::BYTES_UPLOADED, stride * numVertices);
+    if (indices != nullptr) {
+        // the element buffer binding is part of the vertex array state
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices->getId());
     }
-    glBufferData(GL_ARRAY_BUFFER, byteOffset * numVertices, data, GL_STATIC_DRAW);
     this->numVertices = numVertices;
 }
 
+Mesh::~Mesh() {
+    renderstate::forgetVertexArray(vao);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+}
+
 void Mesh::render() const {
-    glBindVertexArray(vao);
-    glDrawArrays(GL_TRIANGLES, 0, numVertices);
+    renderstate::bindVertexArray(vao);
+    renderstate::countDraw();
+    if (indices != nullptr) {
+        glDrawElements(GL_TRIANGLES, indices->getNumIndices(), GL_UNSIGNED_SHORT, (void*) 0);
+    } else {
+        glDrawArrays(GL_TRIANGLES, 0, numVertices);
+    }
+}
+
+unsigned int Mesh::createInstancedVertexArray(unsigned int instanceBuffer, const VertexAttribSet& instanceAttribSet) const {
+    unsigned int instancedVao;
+    glGenVertexArrays(1, &instancedVao);
+    renderstate::bindVertexArray(instancedVao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    setAttributes(attribSet, 0, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    setAttributes(instanceAttribSet, static_cast<unsigned int>(attribSet.size()), 1);
+    if (indices != nullptr) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices->getId());
+    }
+    return instancedVao;
+}
+
+void Mesh::renderInstanced(unsigned int instancedVao, int numInstances) const {
+    renderstate::bindVertexArray(instancedVao);
+    renderstate::countDraw();
+    if (indices != nullptr) {
+        glDrawElementsInstanced(GL_TRIANGLES, indices->getNumIndices(), GL_UNSIGNED_SHORT, (void*) 0, numInstances);
+    } else {
+        glDrawArraysInstanced(GL_TRIANGLES, 0, numVertices, numInstances);
+    }
+}
+
+unsigned int Mesh::getId() const {
+    return vao;
+}
+
+void Mesh::render(IndexRange range) const {
+    renderstate::bindVertexArray(vao);
+    renderstate::countDraw();
+    glDrawElements(GL_TRIANGLES, range.count, GL_UNSIGNED_SHORT, (void*) (range.first * sizeof(unsigned short)));
 }
 
 float cubeVertices[288] = {
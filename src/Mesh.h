@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>
+#include <memory>
 #include <vector>
 
 #include <glad/glad.h>
@@ -9,18 +10,65 @@ struct VertexAttribute {
     GLenum type;
     size_t numElements;
     size_t sizeOfType;
+    // integer types are mapped to [0, 1] / [-1, 1] instead of converted to float
+    bool normalized = false;
+    // integer types are passed to the shader as ints/uints (glVertexAttribIPointer)
+    bool integer = false;
 };
 
+// attributes are tightly packed in this order, the stride is the sum of their sizes
 using VertexAttribSet = std::vector<VertexAttribute>;
 
+// a contiguous run of indices within an IndexBuffer
+struct IndexRange {
+    unsigned int first;
+    unsigned int count;
+};
+
+// Element buffer of 16 bit indices. One buffer can be shared by any number of meshes.
+class IndexBuffer {
+private:
+    unsigned int ebo;
+    unsigned int numIndices;
+public:
+    IndexBuffer(const unsigned short* indices, int numIndices);
+    ~IndexBuffer();
+
+    IndexBuffer(const IndexBuffer&) = delete;
+    IndexBuffer& operator=(const IndexBuffer&) = delete;
+
+    unsigned int getId() const;
+    unsigned int getNumIndices() const;
+};
+
 class Mesh {
 private:
     unsigned int vao;
+    unsigned int vbo;
     unsigned int numVertices;
+    // layout of vbo, kept to set up instanced vertex arrays over it
+    VertexAttribSet attribSet;
+    const IndexBuffer* indices;
 public:
-    Mesh(float* data, int numVertices, const VertexAttribSet& attribSet);
+    // If indices is given the mesh is drawn with it, it must outlive the mesh.
+    Mesh(const void* data, int numVertices, const VertexAttribSet& attribSet, const IndexBuffer* indices = nullptr);
+    // releases the vertex array and buffer
+    ~Mesh();
+
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
 
     void render() const;
+    unsigned int getId() const;
+    // draws only the given range of the index buffer
+    void render(IndexRange range) const;
+    // Creates a vertex array with the mesh's attributes followed by per instance attributes
+    // read from instanceBuffer, in the locations after the mesh's own. The caller owns it and
+    // must forget it in renderstate before deleting it. The buffer can be resized later,
+    // the vertex array keeps pointing at it.
+    unsigned int createInstancedVertexArray(unsigned int instanceBuffer, const VertexAttribSet& instanceAttribSet) const;
+    // draws numInstances copies of the mesh with a vertex array from createInstancedVertexArray
+    void renderInstanced(unsigned int instancedVao, int numInstances) const;
 };
 
 using MeshPtr = std::unique_ptr<Mesh>;
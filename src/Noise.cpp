@@ -0,0 +1,42 @@
+#include "Noise.h"
+
+const std::vector<noise::NoisePreset>& noise::getPresets() {
+    static const std::vector<NoisePreset> presets = {
+        makePreset<ClassicNoise>(),
+        makePreset<HillsNoise>(),
+        makePreset<RidgesNoise>(),
+        makePreset<DunesNoise>(),
+        makePreset<WarpedNoise>()
+    };
+    return presets;
+}
+
+const noise::NoisePreset& noise::getDefaultPreset() {
+    return getPresets().front();
+}
+
+const noise::NoisePreset* noise::findPreset(const std::string& name) {
+    for (const NoisePreset& preset : getPresets()) {
+        if (name == preset.name) {
+            return &preset;
+        }
+    }
+    return nullptr;
+}
+
+const char* noise::getBackendName(NoiseBackend backend) {
+    switch (backend) {
+        case NoiseBackend::TABLE: return "table";
+        default: return "hash";
+    }
+}
+
+bool noise::findBackend(const std::string& name, NoiseBackend& backend) {
+    for (NoiseBackend candidate : {NoiseBackend::HASH, NoiseBackend::TABLE}) {
+        if (name == getBackendName(candidate)) {
+            backend = candidate;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,345 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Math.h"
+
+// Fractal noise built from octaves of Perlin noise, see NoiseSource for where the
+// octaves come from.
+//
+// A noise configuration is a struct of constants (see ClassicNoise below). Every
+// configuration instantiates its own sampling kernel: octave frequencies and
+// amplitudes are folded at compile time, the octave loop is unrolled and folds or
+// warps a configuration doesn't use are compiled out. Octaves too fine to show up
+// at the sample spacing are skipped, so adding detail octaves only costs where
+// they can actually be seen.
+//
+// A configuration provides:
+//   name           registry name
+//   octaves        number of layers of noise
+//   lacunarity     frequency multiplier from one octave to the next
+//   gain           amplitude multiplier from one octave to the next
+//   fold           what is done to each octave before it is summed, see NoiseFold
+//   warp           domain warp strength in noise units, 0 disables it
+//   warpFrequency  frequency of the noise that displaces the sample points
+//   toHeight(n)    maps the normalized sum to a terrain height
+
+#define NOISE_MAX_OCTAVE_SPACING 0.5f // Octaves whose lattice is sampled coarser than this per sample are skipped.
+
+// where single octaves of noise come from
+enum class NoiseBackend {
+    HASH,  // math::getPerlinNoise, gradients from an integer hash, the same for every seed
+    TABLE  // math::PermutationTable, gradients picked through a table shuffled by the seed
+};
+
+enum class NoiseFold {
+    NONE,   // plain fBm
+    RIDGED, // (1 - |n|)^2, sharp crests where the noise crosses zero
+    BILLOW  // |n|, round bumps with creases in between
+};
+
+namespace noise {
+    // Single octave noise of one backend and seed, what the octaves are sampled from.
+    // Cheap to copy, the permutation table is shared between sources of the same seed.
+    class NoiseSource {
+    private:
+        NoiseBackend backend;
+        unsigned int seed;
+        const math::PermutationTable* table;
+    public:
+        NoiseSource(unsigned int seed, NoiseBackend backend = NoiseBackend::HASH)
+            : backend(backend), seed(seed), table(backend == NoiseBackend::TABLE ? &math::getPermutationTable(seed) : nullptr) {}
+
+        NoiseBackend getBackend() const {
+            return backend;
+        }
+
+        float sample(float x, float y) const {
+            return table != nullptr ? table->getNoise(x, y) : math::getPerlinNoise(x, y, seed);
+        }
+
+        // for grids at least as fine as the noise lattice, see math::getPerlinNoiseGridShared
+        void sampleGrid(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny) const {
+            if (table != nullptr) {
+                table->getNoiseGrid(out, stride, x0, y0, dx, dy, nx, ny);
+            } else {
+                math::getPerlinNoiseGridShared(out, stride, x0, y0, dx, dy, nx, ny, seed);
+            }
+        }
+
+        void samplePoints(float* out, const float* xs, const float* ys, int n) const {
+            if (table != nullptr) {
+                table->getNoisePoints(out, xs, ys, n);
+            } else {
+                math::getPerlinNoisePoints(out, xs, ys, n, seed);
+            }
+        }
+    };
+
+    const char* getBackendName(NoiseBackend backend);
+    // false if there is no backend with that name
+    bool findBackend(const std::string& name, NoiseBackend& backend);
+
+    constexpr float constPow(float base, int exponent) {
+        return exponent == 0 ? 1.0f : base * constPow(base, exponent - 1);
+    }
+
+    // sum of the octave amplitudes, the octaves are divided by it so the sum stays in range
+    template <typename Config>
+    constexpr float amplitudeSum(int octave = 0) {
+        return octave == Config::octaves ? 0.0f : constPow(Config::gain, octave) + amplitudeSum<Config>(octave + 1);
+    }
+
+    template <NoiseFold Fold>
+    inline float fold(float n) {
+        if constexpr (Fold == NoiseFold::RIDGED) {
+            float r = 1.0f - std::abs(n);
+            return r * r;
+        } else if constexpr (Fold == NoiseFold::BILLOW) {
+            return std::abs(n);
+        } else {
+            return n;
+        }
+    }
+
+    // Average of a folded octave, added in place of octaves that are skipped so that
+    // leaving out detail doesn't shift the terrain up or down.
+    // measured over 2M random points in [0, 4096)^2, three seeds of both backends
+    template <NoiseFold Fold>
+    constexpr float foldMean() {
+        return Fold == NoiseFold::RIDGED ? 0.71f : (Fold == NoiseFold::BILLOW ? 0.167f : 0.0f);
+    }
+
+    // offset of each octave in noise space so the lattices of the octaves don't line up
+    constexpr float octaveOffset(int octave, float scale) {
+        return octave == 0 ? 0.0f : octave * scale;
+    }
+
+    template <typename Config, int Index>
+    struct Octave {
+        static constexpr float frequency = constPow(Config::lacunarity, Index);
+        static constexpr float amplitude = constPow(Config::gain, Index) / amplitudeSum<Config>();
+        static constexpr float offsetX = octaveOffset(Index, 17.137f);
+        static constexpr float offsetY = octaveOffset(Index, 31.713f);
+
+        static bool visible(float spacing) {
+            return frequency * spacing <= NOISE_MAX_OCTAVE_SPACING;
+        }
+    };
+
+    template <typename Config, int... Octaves>
+    inline float sampleOctaves(float x, float y, const NoiseSource& source, float spacing, std::integer_sequence<int, Octaves...>) {
+        float sum = 0;
+        ((sum += Octave<Config, Octaves>::visible(spacing)
+            ? Octave<Config, Octaves>::amplitude * fold<Config::fold>(source.sample(
+                x * Octave<Config, Octaves>::frequency + Octave<Config, Octaves>::offsetX,
+                y * Octave<Config, Octaves>::frequency + Octave<Config, Octaves>::offsetY))
+            : Octave<Config, Octaves>::amplitude * foldMean<Config::fold>()), ...);
+        return sum;
+    }
+
+    template <typename Config>
+    inline void warpPoint(float& x, float& y, const NoiseSource& source) {
+        if constexpr (Config::warp != 0.0f) {
+            float wx = source.sample(x * Config::warpFrequency + 5.2f, y * Config::warpFrequency + 1.3f);
+            float wy = source.sample(x * Config::warpFrequency + 9.7f, y * Config::warpFrequency + 2.8f);
+            x += Config::warp * wx;
+            y += Config::warp * wy;
+        }
+    }
+
+    // Terrain height of the configuration at noise space x, y. spacing is the distance
+    // between neighbouring samples, octaves finer than it can show are skipped.
+    template <typename Config>
+    float sample(float x, float y, const NoiseSource& source, float spacing) {
+        warpPoint<Config>(x, y, source);
+        return Config::toHeight(sampleOctaves<Config>(x, y, source, spacing, std::make_integer_sequence<int, Config::octaves>()));
+    }
+
+    // samples of one sampleGrid call, shared by its octaves
+    struct GridBlock {
+        float x0, y0, dx, dy;
+        int nx, ny;
+        const NoiseSource& source;
+        float spacing;
+        // every octave's samples, octave o at o * nx * ny, not written for skipped octaves
+        std::vector<float> layers;
+        // warped sample points and their copies scaled to the current octave, empty without a warp
+        std::vector<float> xs, ys, octaveXs, octaveYs;
+    };
+
+    // Samples one octave of the block into its layer in one SIMD batch, on the grid or at
+    // the warped points.
+    template <typename Config, int O>
+    inline void sampleOctave(GridBlock& block) {
+        using Layer = Octave<Config, O>;
+        if (!Layer::visible(block.spacing)) {
+            return;
+        }
+        const int count = block.nx * block.ny;
+        float* layer = block.layers.data() + O * count;
+        if constexpr (Config::warp != 0.0f) {
+            for (int k = 0; k < count; k++) {
+                block.octaveXs[k] = block.xs[k] * Layer::frequency + Layer::offsetX;
+                block.octaveYs[k] = block.ys[k] * Layer::frequency + Layer::offsetY;
+            }
+            block.source.samplePoints(layer, block.octaveXs.data(), block.octaveYs.data(), count);
+        } else {
+            // visible octaves have at least two samples per lattice square, so the gradients are shared
+            block.source.sampleGrid(
+                layer, block.ny,
+                block.x0 * Layer::frequency + Layer::offsetX, block.y0 * Layer::frequency + Layer::offsetY,
+                block.dx * Layer::frequency, block.dy * Layer::frequency,
+                block.nx, block.ny
+            );
+        }
+    }
+
+    // samples every octave the spacing shows into its layer and marks which ones those are
+    template <typename Config, int... Octaves>
+    inline void sampleLayers(GridBlock& block, bool* visible, std::integer_sequence<int, Octaves...>) {
+        ((visible[Octaves] = Octave<Config, Octaves>::visible(block.spacing)), ...);
+        (sampleOctave<Config, Octaves>(block), ...);
+    }
+
+    // folded and weighted sum of every octave at sample k, added up in the same order as sampleOctaves
+    template <typename Config, int... Octaves>
+    inline float sumLayers(const GridBlock& block, const bool* visible, int k, std::integer_sequence<int, Octaves...>) {
+        const int count = block.nx * block.ny;
+        float sum = 0;
+        ((sum += visible[Octaves]
+            ? Octave<Config, Octaves>::amplitude * fold<Config::fold>(block.layers[Octaves * count + k])
+            : Octave<Config, Octaves>::amplitude * foldMean<Config::fold>()), ...);
+        return sum;
+    }
+
+    // Grid version of sample: writes the height at (x0 + i * dx, y0 + j * dy) to
+    // out[i * stride + j] for 0 <= i < nx and 0 <= j < ny. The octaves are sampled one
+    // batch each, then a single pass over the points folds, sums and maps them to heights.
+    template <typename Config>
+    void sampleGrid(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny, const NoiseSource& source, float spacing) {
+        using Octaves = std::make_integer_sequence<int, Config::octaves>;
+        const int count = nx * ny;
+        GridBlock block{x0, y0, dx, dy, nx, ny, source, spacing, std::vector<float>(Config::octaves * count), {}, {}, {}, {}};
+        if constexpr (Config::warp != 0.0f) {
+            // displace the grid once, every octave samples the same warped points
+            const float f = Config::warpFrequency;
+            block.xs.resize(count);
+            block.ys.resize(count);
+            block.octaveXs.resize(count);
+            block.octaveYs.resize(count);
+            source.sampleGrid(block.xs.data(), ny, x0 * f + 5.2f, y0 * f + 1.3f, dx * f, dy * f, nx, ny);
+            source.sampleGrid(block.ys.data(), ny, x0 * f + 9.7f, y0 * f + 2.8f, dx * f, dy * f, nx, ny);
+            for (int i = 0; i < nx; i++) {
+                for (int j = 0; j < ny; j++) {
+                    block.xs[i * ny + j] = x0 + i * dx + Config::warp * block.xs[i * ny + j];
+                    block.ys[i * ny + j] = y0 + j * dy + Config::warp * block.ys[i * ny + j];
+                }
+            }
+        }
+        bool visible[Config::octaves];
+        sampleLayers<Config>(block, visible, Octaves());
+        for (int i = 0; i < nx; i++) {
+            for (int j = 0; j < ny; j++) {
+                out[i * stride + j] = Config::toHeight(sumLayers<Config>(block, visible, i * ny + j, Octaves()));
+            }
+        }
+    }
+
+    // A configuration picked at runtime, see getPresets.
+    struct NoisePreset {
+        const char* name;
+        float (*sample)(float x, float y, const NoiseSource& source, float spacing);
+        void (*sampleGrid)(float* out, size_t stride, float x0, float y0, float dx, float dy, int nx, int ny, const NoiseSource& source, float spacing);
+    };
+
+    template <typename Config>
+    NoisePreset makePreset() {
+        return NoisePreset{Config::name, &sample<Config>, &sampleGrid<Config>};
+    }
+
+    // every built in preset, the first one is the default
+    const std::vector<NoisePreset>& getPresets();
+    const NoisePreset& getDefaultPreset();
+    // nullptr if there is no preset with that name
+    const NoisePreset* findPreset(const std::string& name);
+}
+
+// The original terrain: a single octave, squared so valleys flatten out.
+struct ClassicNoise {
+    static constexpr const char* name = "classic";
+    static constexpr int octaves = 1;
+    static constexpr float lacunarity = 2.0f;
+    static constexpr float gain = 0.5f;
+    static constexpr NoiseFold fold = NoiseFold::NONE;
+    static constexpr float warp = 0.0f;
+    static constexpr float warpFrequency = 1.0f;
+
+    static float toHeight(float n) {
+        return n * n * 52 - 2;
+    }
+};
+
+// Rolling fBm hills with detail down to the lattice spacing.
+struct HillsNoise {
+    static constexpr const char* name = "hills";
+    static constexpr int octaves = 6;
+    static constexpr float lacunarity = 2.0f;
+    static constexpr float gain = 0.5f;
+    static constexpr NoiseFold fold = NoiseFold::NONE;
+    static constexpr float warp = 0.0f;
+    static constexpr float warpFrequency = 1.0f;
+
+    static float toHeight(float n) {
+        return n * n * 52 + n * 10 - 2;
+    }
+};
+
+// Mountain ridges from ridged octaves.
+struct RidgesNoise {
+    static constexpr const char* name = "ridges";
+    static constexpr int octaves = 6;
+    static constexpr float lacunarity = 2.1f;
+    static constexpr float gain = 0.45f;
+    static constexpr NoiseFold fold = NoiseFold::RIDGED;
+    static constexpr float warp = 0.0f;
+    static constexpr float warpFrequency = 1.0f;
+
+    static float toHeight(float n) {
+        return (n - 0.55f) * 60;
+    }
+};
+
+// Low rounded dunes from billowed octaves.
+struct DunesNoise {
+    static constexpr const char* name = "dunes";
+    static constexpr int octaves = 5;
+    static constexpr float lacunarity = 2.0f;
+    static constexpr float gain = 0.5f;
+    static constexpr NoiseFold fold = NoiseFold::BILLOW;
+    static constexpr float warp = 0.0f;
+    static constexpr float warpFrequency = 1.0f;
+
+    static float toHeight(float n) {
+        return n * 25 - 1.5f;
+    }
+};
+
+// fBm with its domain warped by a low frequency noise, gives swirled, eroded looking shapes.
+struct WarpedNoise {
+    static constexpr const char* name = "warped";
+    static constexpr int octaves = 5;
+    static constexpr float lacunarity = 2.0f;
+    static constexpr float gain = 0.5f;
+    static constexpr NoiseFold fold = NoiseFold::NONE;
+    static constexpr float warp = 0.6f;
+    static constexpr float warpFrequency = 0.5f;
+
+    static float toHeight(float n) {
+        return n * n * 52 - 2;
+    }
+};
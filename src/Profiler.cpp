@@ -0,0 +1,200 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define COUNTER_COUNT static_cast<int>(ProfileCounter::COUNT)
+
+struct ZoneEvent {
+    const char* name;
+    // microseconds since the profiler started
+    double start;
+    double duration;
+};
+
+// Zones of one thread in a ring buffer. The lock is only contended while a trace is written.
+struct ThreadEvents {
+    int tid;
+    std::mutex mutex;
+    std::vector<ZoneEvent> events;
+    size_t next = 0;
+};
+
+struct FrameRecord {
+    double start;
+    double duration;
+    long long counters[COUNTER_COUNT];
+};
+
+// Thread buffers are never freed so zones of finished threads still show up in the trace.
+static std::mutex threadsMutex;
+static std::vector<std::unique_ptr<ThreadEvents>> threads;
+
+static std::atomic<long long> counters[COUNTER_COUNT];
+static long long lastCounters[COUNTER_COUNT];
+
+static std::mutex framesMutex;
+static std::vector<FrameRecord> frames;
+static size_t nextFrame = 0;
+static double frameStart = -1;
+
+static double now() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+static ThreadEvents& getThreadEvents() {
+    thread_local ThreadEvents* events = nullptr;
+    if (events == nullptr) {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        threads.push_back(std::make_unique<ThreadEvents>());
+        events = threads.back().get();
+        events->tid = static_cast<int>(threads.size());
+    }
+    return *events;
+}
+
+// oldest first
+template <typename T>
+static std::vector<T> unroll(const std::vector<T>& ring, size_t next) {
+    std::vector<T> ordered(ring.begin() + next, ring.end());
+    ordered.insert(ordered.end(), ring.begin(), ring.begin() + next);
+    return ordered;
+}
+
+profiler::Zone::Zone(const char* name) : name(name), start(now()) {}
+
+profiler::Zone::~Zone() {
+    ZoneEvent event = {name, start, now() - start};
+    ThreadEvents& thread = getThreadEvents();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    if (thread.events.size() < PROFILE_MAX_EVENTS) {
+        thread.events.push_back(event);
+    } else {
+        thread.events[thread.next] = event;
+        thread.next = (thread.next + 1) % PROFILE_MAX_EVENTS;
+    }
+}
+
+void profiler::beginFrame() {
+    double time = now();
+    std::lock_guard<std::mutex> lock(framesMutex);
+    if (frameStart >= 0) {
+        FrameRecord frame;
+        frame.start = frameStart;
+        frame.duration = time - frameStart;
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            frame.counters[i] = lastCounters[i] = counters[i].exchange(0);
+        }
+        if (frames.size() < PROFILE_HISTORY_FRAMES) {
+            frames.push_back(frame);
+        } else {
+            frames[nextFrame] = frame;
+            nextFrame = (nextFrame + 1) % PROFILE_HISTORY_FRAMES;
+        }
+    }
+    frameStart = time;
+}
+
+void profiler::addCounter(ProfileCounter counter, long long amount) {
+    counters[static_cast<int>(counter)] += amount;
+}
+
+long long profiler::getLastFrameCounter(ProfileCounter counter) {
+    std::lock_guard<std::mutex> lock(framesMutex);
+    return lastCounters[static_cast<int>(counter)];
+}
+
+const char* profiler::getCounterName(ProfileCounter counter) {
+    switch (counter) {
+        case ProfileCounter::CELLS_GENERATED:
+            return "cells generated";
+        case ProfileCounter::BYTES_UPLOADED:
+            return "bytes uploaded";
+        case ProfileCounter::DRAW_CALLS:
+            return "draw calls";
+        default:
+            return "unknown";
+    }
+}
+
+bool profiler::writeChromeTrace(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    auto separator = [&]() -> std::ostream& {
+        out << (first ? "" : ",\n");
+        first = false;
+        return out;
+    };
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        for (const auto& thread : threads) {
+            std::lock_guard<std::mutex> threadLock(thread->mutex);
+            for (const ZoneEvent& event : unroll(thread->events, thread->next)) {
+                separator() << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->tid
+                            << ",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}";
+            }
+        }
+    }
+    {
+        // frames on their own track with the counters of each frame
+        std::lock_guard<std::mutex> lock(framesMutex);
+        for (const FrameRecord& frame : unroll(frames, nextFrame)) {
+            separator() << "{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":" << frame.start
+                        << ",\"dur\":" << frame.duration << "}";
+            for (int i = 0; i < COUNTER_COUNT; i++) {
+                separator() << "{\"name\":\"" << getCounterName(static_cast<ProfileCounter>(i)) << "\",\"ph\":\"C\",\"pid\":1,\"ts\":"
+                            << frame.start << ",\"args\":{\"value\":" << frame.counters[i] << "}}";
+            }
+        }
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+bool profiler::writeFrameHistogram(const std::string& path) {
+    std::vector<double> times;
+    {
+        std::lock_guard<std::mutex> lock(framesMutex);
+        for (const FrameRecord& frame : frames) {
+            times.push_back(frame.duration / 1000.0);
+        }
+    }
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    long long buckets[PROFILE_HISTOGRAM_BUCKETS] = {};
+    double total = 0;
+    for (double ms : times) {
+        buckets[std::min(static_cast<int>(ms), PROFILE_HISTOGRAM_BUCKETS - 1)]++;
+        total += ms;
+    }
+    std::sort(times.begin(), times.end());
+    auto percentile = [&](double p) {
+        return times.empty() ? 0.0 : times[static_cast<size_t>(p * (times.size() - 1))];
+    };
+    out << "{\n";
+    out << "  \"frames\": " << times.size() << ",\n";
+    out << "  \"mean_ms\": " << (times.empty() ? 0.0 : total / times.size()) << ",\n";
+    out << "  \"p50_ms\": " << percentile(0.5) << ",\n";
+    out << "  \"p95_ms\": " << percentile(0.95) << ",\n";
+    out << "  \"p99_ms\": " << percentile(0.99) << ",\n";
+    out << "  \"max_ms\": " << (times.empty() ? 0.0 : times.back()) << ",\n";
+    out << "  \"bucket_ms\": 1,\n";
+    out << "  \"buckets\": [";
+    for (int i = 0; i < PROFILE_HISTOGRAM_BUCKETS; i++) {
+        out << (i > 0 ? ", " : "") << buckets[i];
+    }
+    out << "]\n}\n";
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+
+// Scoped zone profiler for finding where a frame's time goes. Zones and counters are
+// only recorded when built with PROFILE_ENABLED (the EVOLUTION_PROFILE CMake option),
+// otherwise the macros below compile to nothing.
+
+#define PROFILE_MAX_EVENTS 65536 // Zones kept per thread, the oldest are overwritten first.
+#define PROFILE_HISTORY_FRAMES 1024 // Frames kept for the counters and the frame time histogram.
+#define PROFILE_HISTOGRAM_BUCKETS 50 // One bucket per millisecond, the last one also holds longer frames.
+
+enum class ProfileCounter {
+    CELLS_GENERATED,
+    BYTES_UPLOADED,
+    DRAW_CALLS,
+    COUNT
+};
+
+namespace profiler {
+    // Records the time between construction and destruction as a zone on the calling thread.
+    // The name must outlive the profiler, string literals are expected.
+    class Zone {
+    private:
+        const char* name;
+        double start;
+    public:
+        Zone(const char* name);
+        ~Zone();
+
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+    };
+
+    // Ends the current frame and starts the next, call once per frame on the main thread.
+    void beginFrame();
+    // adds to the counter of the current frame, thread safe
+    void addCounter(ProfileCounter counter, long long amount);
+    // value of the counter over the last complete frame
+    long long getLastFrameCounter(ProfileCounter counter);
+    const char* getCounterName(ProfileCounter counter);
+
+    // Writes the recorded zones, frames and counters as Chrome trace event JSON
+    // (chrome://tracing, Perfetto). Returns false if the file couldn't be written.
+    bool writeChromeTrace(const std::string& path);
+    // Writes a JSON histogram of the recent frame times in milliseconds.
+    bool writeFrameHistogram(const std::string& path);
+}
+
+#ifdef PROFILE_ENABLED
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) profiler::Zone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_COUNTER(counter, amount) profiler::addCounter(counter, amount)
+#define PROFILE_FRAME() profiler::beginFrame()
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_COUNTER(counter, amount)
+#define PROFILE_FRAME()
+#endif
@@ -0,0 +1,402 @@
+#include "RegionStore.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "MappedFile.h"
+#include "Profiler.h"
+
+#define REGION_CELLS (REGION_SIZE * REGION_SIZE)
+#define REGION_HEADER_SIZE 20
+#define REGION_TABLE_SIZE (REGION_CELLS * 8)
+
+static const char regionMagic[4] = {'T', 'R', 'G', 'N'};
+
+// A region file mapped read only. The mapping lives as long as the last reference to it,
+// so readers keep using it safely while a newer version of the file is being written.
+struct MappedRegion : MappedFile {
+    // The offset table as it was when the file was mapped. Appending rewrites the file's
+    // table in place, this copy keeps pointing at records inside this mapping.
+    uint32_t table[REGION_CELLS][2];
+
+    // returns the record of a cell, or nullptr if the file doesn't have it
+    const char* getRecord(int index, uint32_t& recordSize) const {
+        if (table[index][0] == 0 || table[index][0] + static_cast<size_t>(table[index][1]) > size) {
+            return nullptr;
+        }
+        recordSize = table[index][1];
+        return data + table[index][0];
+    }
+};
+
+// maps the file and checks its header, nullptr if it is missing or doesn't belong to this seed and region
+static std::shared_ptr<MappedRegion> mapRegion(const std::string& path, int seed, CellKey region) {
+    auto mapped = std::make_shared<MappedRegion>();
+    if (!mapped->open(path) || mapped->size < REGION_HEADER_SIZE + REGION_TABLE_SIZE) {
+        return nullptr;
+    }
+    int32_t header[4];
+    std::memcpy(header, mapped->data + 4, sizeof(header));
+    if (std::memcmp(mapped->data, regionMagic, 4) != 0 || header[0] != REGION_FORMAT_VERSION
+        || header[1] != seed || header[2] != region.x || header[3] != region.z) {
+        return nullptr;
+    }
+    std::memcpy(mapped->table, mapped->data + REGION_HEADER_SIZE, sizeof(mapped->table));
+    return mapped;
+}
+
+template <typename T>
+static void append(std::vector<char>& out, const T* values, size_t count) {
+    const char* bytes = reinterpret_cast<const char*>(values);
+    out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+template <typename T>
+static void append(std::vector<char>& out, const T& value) {
+    append(out, &value, 1);
+}
+
+static std::vector<char> writeRecord(const TerrainCellData& cell) {
+    std::vector<char> out;
+    append(out, static_cast<int32_t>(cell.lod));
+    append(out, &cell.latticePoints[0][0], (TERRAIN_POINTS_PER_CELL + 1) * (TERRAIN_POINTS_PER_CELL + 1));
+    append(out, &cell.boundsMin.x, 3);
+    append(out, &cell.boundsMax.x, 3);
+    append(out, static_cast<uint32_t>(cell.vertices.size()));
+    append(out, cell.vertices.data(), cell.vertices.size());
+    append(out, static_cast<uint32_t>(cell.heightmap.size()));
+    append(out, cell.heightmap.data(), cell.heightmap.size());
+    append(out, static_cast<uint32_t>(cell.objects.size()));
+    for (const ObjectPlacement& object : cell.objects) {
+        append(out, static_cast<uint32_t>(object.type));
+        append(out, &object.pos.x, 3);
+        append(out, &object.scale.x, 3);
+    }
+    return out;
+}
+
+// Reads values out of a record, every read is bounds checked so a damaged file
+// fails the load instead of reading past the mapping.
+class RecordReader {
+private:
+    const char* data;
+    size_t size;
+    size_t offset = 0;
+public:
+    RecordReader(const char* data, size_t size) : data(data), size(size) {}
+
+    template <typename T>
+    bool read(T* values, size_t count) {
+        if (offset + count * sizeof(T) > size) {
+            return false;
+        }
+        std::memcpy(values, data + offset, count * sizeof(T));
+        offset += count * sizeof(T);
+        return true;
+    }
+
+    template <typename T>
+    bool read(T& value) {
+        return read(&value, 1);
+    }
+
+    // reads a length prefixed array
+    template <typename T>
+    bool read(std::vector<T>& values) {
+        uint32_t count;
+        if (!read(count) || offset + static_cast<size_t>(count) * sizeof(T) > size) {
+            return false;
+        }
+        values.resize(count);
+        return read(values.data(), count);
+    }
+};
+
+static bool readRecord(const char* data, size_t size, int x, int z, TerrainCellData& cell) {
+    RecordReader reader(data, size);
+    int32_t lod;
+    uint32_t numObjects;
+    bool ok = reader.read(lod)
+        && reader.read(&cell.latticePoints[0][0], (TERRAIN_POINTS_PER_CELL + 1) * (TERRAIN_POINTS_PER_CELL + 1))
+        && reader.read(&cell.boundsMin.x, 3)
+        && reader.read(&cell.boundsMax.x, 3)
+        && reader.read(cell.vertices)
+        && reader.read(cell.heightmap)
+        && reader.read(numObjects);
+    if (!ok) {
+        return false;
+    }
+    cell.x = x;
+    cell.z = z;
+    cell.lod = lod;
+    cell.objects.clear();
+    for (uint32_t i = 0; i < numObjects; i++) {
+        uint32_t type;
+        ObjectPlacement object;
+        if (!reader.read(type) || !reader.read(&object.pos.x, 3) || !reader.read(&object.scale.x, 3)) {
+            return false;
+        }
+        object.type = static_cast<ObjectType>(type);
+        cell.objects.push_back(object);
+    }
+    return true;
+}
+
+static int floorDiv(int a, int b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+static int getCellIndex(int x, int z) {
+    return (x - floorDiv(x, REGION_SIZE) * REGION_SIZE) * REGION_SIZE + (z - floorDiv(z, REGION_SIZE) * REGION_SIZE);
+}
+
+RegionStore::RegionStore(const std::string& directory, int seed)
+    : directory(directory + "/" + terraingen::getNoisePreset().name + "-" + noise::getBackendName(terraingen::getNoiseBackend()) + "/" + std::to_string(seed)),
+      seed(seed), regions(REGION_STORE_OPEN_REGIONS), writer(1) {
+    std::error_code error;
+    std::filesystem::create_directories(this->directory, error);
+    if (error) {
+        std::cout << "RegionStore: could not create " << this->directory << ": " << error.message() << std::endl;
+    }
+}
+
+RegionStore::~RegionStore() {
+    flush();
+}
+
+std::string RegionStore::getRegionPath(CellKey region) const {
+    return directory + "/r." + std::to_string(region.x) + "." + std::to_string(region.z) + ".bin";
+}
+
+std::shared_ptr<MappedRegion> RegionStore::getRegion(CellKey region) {
+    auto mapped = regions.get(region);
+    if (mapped != nullptr) {
+        return *mapped;
+    }
+    std::shared_ptr<MappedRegion> opened = mapRegion(getRegionPath(region), seed, region);
+    regions.put(region, opened);
+    return opened;
+}
+
+bool RegionStore::load(int x, int z, TerrainCellData& cell) {
+    PROFILE_ZONE("RegionStore::load");
+    CellKey region = {floorDiv(x, REGION_SIZE), floorDiv(z, REGION_SIZE)};
+    int index = getCellIndex(x, z);
+    std::shared_ptr<MappedRegion> mapped;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        regionSwapped.wait(lock, [this, region]() {
+            return swapping.count(region) == 0;
+        });
+        auto records = unwritten.find(region);
+        if (records != unwritten.end()) {
+            auto record = records->second.find(index);
+            if (record != records->second.end()) {
+                return readRecord(record->second.data(), record->second.size(), x, z, cell);
+            }
+        }
+        mapped = getRegion(region);
+    }
+    if (mapped == nullptr) {
+        return false;
+    }
+    uint32_t size;
+    const char* record = mapped->getRecord(index, size);
+    return record != nullptr && readRecord(record, size, x, z, cell);
+}
+
+void RegionStore::save(const TerrainCellData& cell) {
+    if (cell.lod != 0) {
+        return;
+    }
+    CellKey region = {floorDiv(cell.x, REGION_SIZE), floorDiv(cell.z, REGION_SIZE)};
+    std::vector<char> record = writeRecord(cell);
+    std::lock_guard<std::mutex> lock(mutex);
+    unwritten[region][getCellIndex(cell.x, cell.z)] = std::move(record);
+    if (!writesQueued[region]) {
+        // later saves to this region ride along with the queued write
+        writesQueued[region] = true;
+        writesInFlight++;
+        writer.submit([this, region]() {
+            writeRegion(region);
+        });
+    }
+}
+
+void RegionStore::saveHeights(int x, int z, const float* apron) {
+    std::vector<float> heights(apron, apron + TERRAIN_HEIGHTMAP_SIZE * TERRAIN_HEIGHTMAP_SIZE);
+    std::lock_guard<std::mutex> lock(mutex);
+    // counted like a write so flush waits for it
+    writesInFlight++;
+    writer.submit([this, x, z, heights = std::move(heights)]() {
+        save(terraingen::buildCell(x, z, seed, heights.data()));
+        std::lock_guard<std::mutex> lock(mutex);
+        writesInFlight--;
+        writesDone.notify_all();
+    });
+}
+
+void RegionStore::writeRegion(CellKey region) {
+    PROFILE_ZONE("RegionStore::writeRegion");
+    std::unordered_map<int, std::vector<char>> records;
+    std::shared_ptr<MappedRegion> existing;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        writesQueued.erase(region);
+        records = unwritten[region];
+        existing = getRegion(region);
+    }
+
+    // append while at least half the file would still be records in use, rewrite otherwise
+    bool written;
+    if (existing != nullptr) {
+        size_t liveSize = REGION_HEADER_SIZE + REGION_TABLE_SIZE, addedSize = 0;
+        for (int index = 0; index < REGION_CELLS; index++) {
+            auto updated = records.find(index);
+            liveSize += updated != records.end() ? updated->second.size() : existing->table[index][1];
+        }
+        for (const auto& record : records) {
+            addedSize += record.second.size();
+        }
+        if (existing->size + addedSize <= 2 * liveSize) {
+            written = appendRecords(region, std::move(existing), records);
+        } else {
+            written = rewriteRegion(region, std::move(existing), records);
+        }
+    } else {
+        written = rewriteRegion(region, nullptr, records);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!written) {
+        // keep the records in memory, the next save to the region tries again
+        std::cout << "RegionStore: could not write " << getRegionPath(region) << std::endl;
+    } else {
+        // forget the records that are on disk now unless they were saved again meanwhile
+        auto& pending = unwritten[region];
+        for (const auto& record : records) {
+            auto it = pending.find(record.first);
+            if (it != pending.end() && it->second == record.second) {
+                pending.erase(it);
+            }
+        }
+        if (pending.empty()) {
+            unwritten.erase(region);
+        }
+    }
+    writesInFlight--;
+    writesDone.notify_all();
+}
+
+bool RegionStore::appendRecords(CellKey region, std::shared_ptr<MappedRegion> existing, const std::unordered_map<int, std::vector<char>>& records) {
+    PROFILE_ZONE("RegionStore::appendRecords");
+    std::string path = getRegionPath(region);
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(0, std::ios::end);
+    std::streamoff end = file.tellp();
+    if (!file || end < REGION_HEADER_SIZE + REGION_TABLE_SIZE) {
+        return false;
+    }
+    uint32_t table[REGION_CELLS][2];
+    std::memcpy(table, existing->table, sizeof(table));
+    existing.reset();
+    // records only ever go past the end, so mappings taken earlier keep reading theirs intact
+    for (const auto& record : records) {
+        table[record.first][0] = static_cast<uint32_t>(end);
+        table[record.first][1] = static_cast<uint32_t>(record.second.size());
+        file.write(record.second.data(), record.second.size());
+        end += record.second.size();
+    }
+    file.flush();
+    if (!file) {
+        return false;
+    }
+    // under the lock so getRegion never maps the file while the table is half written
+    std::lock_guard<std::mutex> lock(mutex);
+    file.seekp(REGION_HEADER_SIZE);
+    file.write(reinterpret_cast<const char*>(table), sizeof(table));
+    file.close();
+    if (!file) {
+        return false;
+    }
+    regions.put(region, mapRegion(path, seed, region));
+    return true;
+}
+
+bool RegionStore::rewriteRegion(CellKey region, std::shared_ptr<MappedRegion> existing, const std::unordered_map<int, std::vector<char>>& records) {
+    PROFILE_ZONE("RegionStore::rewriteRegion");
+    // new records replace the ones in the current file, the rest are carried over
+    std::vector<char> file;
+    append(file, regionMagic, 4);
+    int32_t header[4] = {REGION_FORMAT_VERSION, seed, region.x, region.z};
+    append(file, header, 4);
+    file.resize(REGION_HEADER_SIZE + REGION_TABLE_SIZE, 0);
+    for (int index = 0; index < REGION_CELLS; index++) {
+        const char* record = nullptr;
+        uint32_t size = 0;
+        auto updated = records.find(index);
+        if (updated != records.end()) {
+            record = updated->second.data();
+            size = static_cast<uint32_t>(updated->second.size());
+        } else if (existing != nullptr) {
+            record = existing->getRecord(index, size);
+        }
+        if (record == nullptr) {
+            continue;
+        }
+        uint32_t entry[2] = {static_cast<uint32_t>(file.size()), size};
+        std::memcpy(file.data() + REGION_HEADER_SIZE + index * 8, entry, sizeof(entry));
+        append(file, record, size);
+    }
+    existing.reset();
+
+    // write next to the old file and swap it in so readers never see a partial file
+    std::string path = getRegionPath(region);
+    std::string tempPath = path + ".tmp";
+    bool written;
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        out.write(file.data(), file.size());
+        written = static_cast<bool>(out);
+    }
+    if (!written) {
+        return false;
+    }
+#ifdef _WIN32
+    // A mapped file can't be replaced on Windows. Hold new loads of the region back until
+    // the new file is in, and wait for the ones still reading the old mapping to let go.
+    std::weak_ptr<MappedRegion> old;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto mapped = regions.peek(region);
+        if (mapped != nullptr) {
+            old = *mapped;
+        }
+        regions.put(region, nullptr);
+        swapping.insert(region);
+    }
+    while (!old.expired()) {
+        std::this_thread::yield();
+    }
+#endif
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // the old file if the rename failed
+    regions.put(region, mapRegion(path, seed, region));
+    swapping.erase(region);
+    regionSwapped.notify_all();
+    return !error;
+}
+
+void RegionStore::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    writesDone.wait(lock, [this]() {
+        return writesInFlight == 0;
+    });
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "TerrainGenerator.h"
+#include "LRUCache.h"
+#include "WorkerPool.h"
+
+#define REGION_SIZE 16 // Cells along each side of a region file.
+#define REGION_FORMAT_VERSION 4 // Bump whenever the record layout or the generator output changes.
+#define REGION_STORE_OPEN_REGIONS 64 // Region files kept mapped at once.
+
+struct MappedRegion;
+
+// Keeps generated full detail cells on disk so they are loaded instead of generated
+// again after a restart or eviction. Cells are grouped into region files of
+// REGION_SIZE squared cells under <directory>/<noise preset>-<noise backend>/<seed>/ and
+// read through memory maps, so set the noise preset and backend before creating the store.
+// The map saves the file read, not the copy: a load copies each array of the record
+// out of the mapping into the cell, since cells edit and keep their data after the file
+// changes.
+//
+// Region file layout, native byte order:
+//   header:       "TRGN", version, seed, region x, region z    (5 x 4 bytes)
+//   offset table: REGION_SIZE^2 x {offset, size}, offset 0 if the cell is missing
+//   records:      lod, lattice points, bounds min/max, vertices, heightmap, placements
+//                 (each array prefixed with its length)
+// Saved cells are appended and their table entries rewritten in place, the records they
+// replace stay behind unused. Once those would make up more than half of the file it is
+// rewritten with only the records in use. Files of another version or seed are ignored
+// and overwritten.
+class RegionStore {
+private:
+    std::string directory;
+    int seed;
+
+    std::mutex mutex;
+    // mapped region files, nullptr for regions that have no file yet
+    LRUCache<CellKey, std::shared_ptr<MappedRegion>, CellKeyHash> regions;
+    // serialized records not on disk yet, by region then by cell index within the region
+    std::unordered_map<CellKey, std::unordered_map<int, std::vector<char>>, CellKeyHash> unwritten;
+    // regions with a write queued or running
+    std::unordered_map<CellKey, bool, CellKeyHash> writesQueued;
+    size_t writesInFlight = 0;
+    std::condition_variable writesDone;
+    // Windows only: regions whose file is being replaced, loads from them wait until it is in
+    std::unordered_set<CellKey, CellKeyHash> swapping;
+    std::condition_variable regionSwapped;
+
+    // declared last so it is joined before the state it writes to is destroyed
+    WorkerPool writer;
+
+    std::string getRegionPath(CellKey region) const;
+    std::shared_ptr<MappedRegion> getRegion(CellKey region);
+    void writeRegion(CellKey region);
+    // writes the records after the end of the existing file and points its table at them
+    bool appendRecords(CellKey region, std::shared_ptr<MappedRegion> existing, const std::unordered_map<int, std::vector<char>>& records);
+    // writes a new file with the records and those of existing still in use, and swaps it in
+    bool rewriteRegion(CellKey region, std::shared_ptr<MappedRegion> existing, const std::unordered_map<int, std::vector<char>>& records);
+public:
+    RegionStore(const std::string& directory, int seed);
+    // waits for queued writes
+    ~RegionStore();
+
+    RegionStore(const RegionStore&) = delete;
+    RegionStore& operator=(const RegionStore&) = delete;
+
+    // Fills cell with the saved cell at x, z. Returns false if it was never saved. Thread safe.
+    bool load(int x, int z, TerrainCellData& cell);
+    // Queues the cell to be written on a background thread. Only level 0 cells are
+    // stored, coarser ones are ignored. Thread safe.
+    void save(const TerrainCellData& cell);
+    // Queues the cell at x, z to be built from edited apron heights, see terraingen::buildCell,
+    // and saved. Both happen on the background thread, in order with the other saves. Thread safe.
+    void saveHeights(int x, int z, const float* apron);
+    // blocks until every queued write is on disk
+    void flush();
+};
@@ -0,0 +1,101 @@
+#include "RenderState.h"
+
+#include <glad/glad.h>
+
+#include "Profiler.h"
+
+// texture targets with a tracked binding per unit
+#define TRACKED_TARGETS 2
+
+static unsigned int currentProgram = 0;
+static unsigned int currentVertexArray = 0;
+static unsigned int activeUnit = 0;
+static unsigned int boundTextures[RENDER_STATE_TEXTURE_UNITS][TRACKED_TARGETS] = {};
+
+static RenderStats frameStats;
+static RenderStats lastFrameStats;
+
+static int getTargetIndex(unsigned int target) {
+    switch (target) {
+        case GL_TEXTURE_2D:
+            return 0;
+        case GL_TEXTURE_2D_ARRAY:
+            return 1;
+        default:
+            return -1;
+    }
+}
+
+void renderstate::useProgram(unsigned int program) {
+    if (program == currentProgram) {
+        frameStats.redundantChanges++;
+        return;
+    }
+    glUseProgram(program);
+    currentProgram = program;
+    frameStats.programChanges++;
+}
+
+void renderstate::bindTexture(unsigned int unit, unsigned int target, unsigned int texture) {
+    int targetIndex = getTargetIndex(target);
+    if (unit < RENDER_STATE_TEXTURE_UNITS && targetIndex >= 0 && boundTextures[unit][targetIndex] == texture) {
+        frameStats.redundantChanges++;
+        return;
+    }
+    if (unit != activeUnit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        activeUnit = unit;
+    }
+    glBindTexture(target, texture);
+    if (unit < RENDER_STATE_TEXTURE_UNITS && targetIndex >= 0) {
+        boundTextures[unit][targetIndex] = texture;
+    }
+    frameStats.textureChanges++;
+}
+
+void renderstate::bindVertexArray(unsigned int vao) {
+    if (vao == currentVertexArray) {
+        frameStats.redundantChanges++;
+        return;
+    }
+    glBindVertexArray(vao);
+    currentVertexArray = vao;
+    frameStats.vertexArrayChanges++;
+}
+
+void renderstate::forgetProgram(unsigned int program) {
+    if (program == currentProgram) {
+        currentProgram = 0;
+    }
+}
+
+void renderstate::forgetTexture(unsigned int texture) {
+    // deleting a texture unbinds it from every unit
+    for (auto& unit : boundTextures) {
+        for (unsigned int& bound : unit) {
+            if (bound == texture) {
+                bound = 0;
+            }
+        }
+    }
+}
+
+void renderstate::forgetVertexArray(unsigned int vao) {
+    if (vao == currentVertexArray) {
+        currentVertexArray = 0;
+    }
+}
+
+void renderstate::countDraw() {
+    frameStats.drawCalls++;
+    PROFILE_COUNTER(ProfileCounter::DRAW_CALLS, 1);
+}
+
+void renderstate::beginFrame() {
+    lastFrameStats = frameStats;
+    frameStats = RenderStats();
+}
+
+const RenderStats& renderstate::getLastFrameStats() {
+    return lastFrameStats;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#define RENDER_STATE_TEXTURE_UNITS 16 // Texture units whose bindings are tracked.
+
+// state changes and draws issued through renderstate during one frame
+struct RenderStats {
+    int programChanges = 0;
+    int textureChanges = 0;
+    int vertexArrayChanges = 0;
+    // changes that were skipped because the object was already bound
+    int redundantChanges = 0;
+    int drawCalls = 0;
+};
+
+// Tracks the bound program, textures and vertex array so redundant GL calls are skipped.
+// All binds of these objects must go through here or the cache goes stale, and objects
+// must be forgotten before they are deleted since GL reuses their names.
+// Render thread only.
+namespace renderstate {
+    void useProgram(unsigned int program);
+    // target is GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY, other targets are bound without caching
+    void bindTexture(unsigned int unit, unsigned int target, unsigned int texture);
+    void bindVertexArray(unsigned int vao);
+
+    void forgetProgram(unsigned int program);
+    void forgetTexture(unsigned int texture);
+    void forgetVertexArray(unsigned int vao);
+
+    void countDraw();
+    // starts counting a new frame, the counters so far become the last frame's
+    void beginFrame();
+    const RenderStats& getLastFrameStats();
+}
@@ -1,11 +1,84 @@
 #include "Shader.h"
+#include "RenderState.h"
+#include "MappedFile.h"
+#include "Profiler.h"
 
 #include <glad/glad.h>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
 
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <sstream>
+#include <vector>
+
+// past GL 3.3, the loader only finds them on drivers that have them
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+#define SHADER_CACHE_HEADER_SIZE 24
+
+static const char shaderMagic[4] = {'T', 'S', 'H', 'B'};
+
+// entry points loaded by shaders::initialize, nullptr when the driver lacks them
+static struct {
+    void (APIENTRYP programBinary)(GLuint program, GLenum format, const void* binary, GLsizei length) = nullptr;
+    void (APIENTRYP getProgramBinary)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* format, void* binary) = nullptr;
+    void (APIENTRYP programParameteri)(GLuint program, GLenum name, GLint value) = nullptr;
+    void (APIENTRYP maxShaderCompilerThreads)(GLuint count) = nullptr;
+    // vendor, renderer and version, a binary only loads on the driver that built it
+    std::string driver;
+} programBinaries;
+
+static bool hasExtension(const char* name) {
+    int numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (int i = 0; i < numExtensions; i++) {
+        const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        if (extension != nullptr && std::strcmp(extension, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void shaders::initialize(void* (*loadProc)(const char* name)) {
+    int major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    int numFormats = 0;
+    if (major > 4 || (major == 4 && minor >= 1) || hasExtension("GL_ARB_get_program_binary")) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    }
+    // some drivers have the functions but no formats to save in
+    if (numFormats > 0) {
+        programBinaries.programBinary = reinterpret_cast<decltype(programBinaries.programBinary)>(loadProc("glProgramBinary"));
+        programBinaries.getProgramBinary = reinterpret_cast<decltype(programBinaries.getProgramBinary)>(loadProc("glGetProgramBinary"));
+        programBinaries.programParameteri = reinterpret_cast<decltype(programBinaries.programParameteri)>(loadProc("glProgramParameteri"));
+        for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+            const char* value = reinterpret_cast<const char*>(glGetString(name));
+            programBinaries.driver += value != nullptr ? value : "";
+            programBinaries.driver += '\n';
+        }
+    }
+    // let the driver compile on as many threads as it likes
+    if (hasExtension("GL_KHR_parallel_shader_compile")) {
+        programBinaries.maxShaderCompilerThreads = reinterpret_cast<decltype(programBinaries.maxShaderCompilerThreads)>(loadProc("glMaxShaderCompilerThreadsKHR"));
+    } else if (hasExtension("GL_ARB_parallel_shader_compile")) {
+        programBinaries.maxShaderCompilerThreads = reinterpret_cast<decltype(programBinaries.maxShaderCompilerThreads)>(loadProc("glMaxShaderCompilerThreadsARB"));
+    }
+    if (programBinaries.maxShaderCompilerThreads != nullptr) {
+        programBinaries.maxShaderCompilerThreads(0xFFFFFFFF);
+    }
+}
 
 std::string read_file(std::string const& filepath) {
     // Open the file
@@ -15,13 +88,16 @@ std::string read_file(std::string const& filepath) {
     return buffer.str();
 }
 
-unsigned int compileShader(std::string const& filepath, int shaderType) {
-    std::string src = read_file(filepath);
+// starts compiling, the status is checked once the program is linked
+unsigned int compileShader(std::string const& src, int shaderType) {
     const char* c_src = src.c_str();
     unsigned int shader = glCreateShader(shaderType);
     glShaderSource(shader, 1, &c_src, NULL);
     glCompileShader(shader);
-    // Check for compile errors.
+    return shader;
+}
+
+static void printCompileErrors(unsigned int shader, std::string const& filepath) {
     int success;
     char infoLog[512];
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
@@ -30,57 +106,177 @@ unsigned int compileShader(std::string const& filepath, int shaderType) {
         std::cout << "ERROR creating shader: " << filepath << std::endl;
         std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
     }
-    return shader;
 }
 
-#include <iostream>
+// FNV-1a over the driver and both sources
+static uint64_t hashSources(std::string const& vsSource, std::string const& fsSource) {
+    uint64_t hash = 14695981039346656037ull;
+    const std::string* parts[] = {&programBinaries.driver, &vsSource, &fsSource};
+    for (const std::string* part : parts) {
+        // the terminator keeps "ab" + "c" apart from "a" + "bc"
+        for (size_t i = 0; i <= part->size(); i++) {
+            hash ^= static_cast<unsigned char>(part->c_str()[i]);
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+// one file per pair of sources, a rebuild overwrites the stale binary
+static std::string getCachePath(std::string const& vsPath, std::string const& fsPath) {
+    return std::string(SHADER_CACHE_DIRECTORY) + "/" + std::filesystem::path(vsPath).stem().string()
+        + "." + std::filesystem::path(fsPath).stem().string() + ".bin";
+}
 
-Shader::Shader(std::string const& vsPath, std::string const& fsPath) {
-    unsigned int vertexShader = compileShader(vsPath, GL_VERTEX_SHADER);
-    unsigned int fragmentShader = compileShader(fsPath, GL_FRAGMENT_SHADER);
+Shader::Shader(std::string const& vsPath, std::string const& fsPath) : vsPath(vsPath), fsPath(fsPath) {
+    PROFILE_ZONE("Shader::Shader");
+    std::string vsSource = read_file(vsPath);
+    std::string fsSource = read_file(fsPath);
+    if (programBinaries.programBinary != nullptr) {
+        this->cachePath = getCachePath(vsPath, fsPath);
+        this->sourceHash = hashSources(vsSource, fsSource);
+        if (this->loadBinary()) {
+            return;
+        }
+    }
+    this->vertexShader = compileShader(vsSource, GL_VERTEX_SHADER);
+    this->fragmentShader = compileShader(fsSource, GL_FRAGMENT_SHADER);
     // make the program
     this->program = glCreateProgram();
-    glAttachShader(this->program, vertexShader);
-    glAttachShader(this->program, fragmentShader);
+    if (!this->cachePath.empty()) {
+        programBinaries.programParameteri(this->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glAttachShader(this->program, this->vertexShader);
+    glAttachShader(this->program, this->fragmentShader);
     glLinkProgram(this->program);
+}
+
+bool Shader::loadBinary() {
+    MappedFile file;
+    if (!file.open(this->cachePath) || file.size < SHADER_CACHE_HEADER_SIZE) {
+        return false;
+    }
+    int32_t header[3];
+    uint64_t hash;
+    std::memcpy(header, file.data + 4, sizeof(header));
+    std::memcpy(&hash, file.data + 16, sizeof(hash));
+    if (std::memcmp(file.data, shaderMagic, 4) != 0 || header[0] != SHADER_CACHE_VERSION
+        || hash != this->sourceHash || SHADER_CACHE_HEADER_SIZE + static_cast<size_t>(header[2]) != file.size) {
+        return false;
+    }
+    this->program = glCreateProgram();
+    programBinaries.programBinary(this->program, static_cast<GLenum>(header[1]), file.data + SHADER_CACHE_HEADER_SIZE, header[2]);
+    // the driver may still turn it down, after an update for example
+    int success;
+    glGetProgramiv(this->program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glDeleteProgram(this->program);
+        return false;
+    }
+    return true;
+}
+
+void Shader::finishLinking() const {
+    if (this->vertexShader == 0) {
+        return;
+    }
+    PROFILE_ZONE("Shader::finishLinking");
     // check for linking errors
     int success;
     char infoLog[512];
     glGetProgramiv(this->program, GL_LINK_STATUS, &success);
     if (!success) {
+        printCompileErrors(this->vertexShader, this->vsPath);
+        printCompileErrors(this->fragmentShader, this->fsPath);
         glGetProgramInfoLog(this->program, 512, NULL, infoLog);
-        std::cout << "ERROR linking shader: " << vsPath << ", " << fsPath << std::endl;
+        std::cout << "ERROR linking shader: " << this->vsPath << ", " << this->fsPath << std::endl;
         std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+    } else if (!this->cachePath.empty()) {
+        int length = 0;
+        glGetProgramiv(this->program, GL_PROGRAM_BINARY_LENGTH, &length);
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        programBinaries.getProgramBinary(this->program, length, &length, &format, binary.data());
+        if (length > 0) {
+            // write next to the old file and swap it in so a concurrent launch never maps a partial file
+            std::error_code error;
+            std::filesystem::create_directories(SHADER_CACHE_DIRECTORY, error);
+            std::string tempPath = this->cachePath + ".tmp";
+            bool written;
+            {
+                std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+                int32_t header[3] = {SHADER_CACHE_VERSION, static_cast<int32_t>(format), length};
+                out.write(shaderMagic, 4);
+                out.write(reinterpret_cast<const char*>(header), sizeof(header));
+                out.write(reinterpret_cast<const char*>(&this->sourceHash), sizeof(this->sourceHash));
+                out.write(binary.data(), length);
+                written = static_cast<bool>(out);
+            }
+            if (written) {
+                std::filesystem::rename(tempPath, this->cachePath, error);
+            }
+            if (!written || error) {
+                std::cout << "Shader: could not write " << this->cachePath << std::endl;
+            }
+        }
     }
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    glDeleteShader(this->vertexShader);
+    glDeleteShader(this->fragmentShader);
+    this->vertexShader = 0;
+    this->fragmentShader = 0;
 }
 
 Shader::~Shader() {
+    renderstate::forgetProgram(this->program);
     glDeleteProgram(this->program);
+    if (this->vertexShader != 0) {
+        glDeleteShader(this->vertexShader);
+        glDeleteShader(this->fragmentShader);
+    }
+}
+
+int Shader::getUniformLocation(const char* uniformName) const {
+    auto it = uniformLocations.find(uniformName);
+    if (it != uniformLocations.end()) {
+        return it->second;
+    }
+    this->finishLinking();
+    int loc = glGetUniformLocation(this->program, uniformName);
+    uniformLocations.emplace(uniformName, loc);
+    return loc;
 }
 
 void Shader::use() const {
-    glUseProgram(this->program);
+    this->finishLinking();
+    renderstate::useProgram(this->program);
+}
+
+unsigned int Shader::getId() const {
+    return this->program;
 }
 
 void Shader::setFloat(const char* uniformName, float v0) const {
-    unsigned int loc = glGetUniformLocation(this->program, uniformName);
+    int loc = getUniformLocation(uniformName);
     glUniform1f(loc, v0);
 }
 
 void Shader::setInt(const char* uniformName, int i0) const {
-    unsigned int loc = glGetUniformLocation(this->program, uniformName);
+    int loc = getUniformLocation(uniformName);
     glUniform1i(loc, i0);
 }
 
 void Shader::setVec2(const char* uniformName, float v0, float v1) const {
-    unsigned int loc = glGetUniformLocation(this->program, uniformName);
+    int loc = getUniformLocation(uniformName);
     glUniform2f(loc, v0, v1);
 }
 
+void Shader::setIVec2(const char* uniformName, int i0, int i1) const {
+    int loc = getUniformLocation(uniformName);
+    glUniform2i(loc, i0, i1);
+}
+
 void Shader::setVec3(const char* uniformName, float v0, float v1, float v2) const {
-    unsigned int loc = glGetUniformLocation(this->program, uniformName);
+    int loc = getUniformLocation(uniformName);
     glUniform3f(loc, v0, v1, v2);
 }
 
@@ -89,7 +285,7 @@ void Shader::setVec3(const char* uniformName, glm::vec3 vec) const {
 }
 
 void Shader::setVec4(const char* uniformName, float v0, float v1, float v2, float v3) const {
-    unsigned int loc = glGetUniformLocation(this->program, uniformName);
+    int loc = getUniformLocation(uniformName);
     glUniform4f(loc, v0, v1, v2, v3);
 }
 
@@ -98,6 +294,6 @@ void Shader::setVec4(const char* uniformName, glm::vec4 vec) const {
 }
 
 void Shader::setMatrix4(const char* uniformName, const glm::mat4& matrix) const {
-    unsigned int loc = glGetUniformLocation(this->program, uniformName);
+    int loc = getUniformLocation(uniformName);
     glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(matrix));
 }
\ No newline at end of file
@@ -1,23 +1,61 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <glm/glm.hpp>
 
+#define SHADER_CACHE_DIRECTORY "assets/cache/shaders" // Linked program binaries, relative to the working directory.
+#define SHADER_CACHE_VERSION 1 // Bump whenever the cache file layout changes.
+
 class Shader {
 private:
     unsigned int program;
+    std::string vsPath, fsPath;
+    // the stages while the link may still be running, 0 once it was checked
+    mutable unsigned int vertexShader = 0, fragmentShader = 0;
+    // where the program binary is cached and the hash of what it was built from, empty
+    // path if the driver can't hand out binaries
+    std::string cachePath;
+    uint64_t sourceHash = 0;
+    // uniform locations looked up so far, -1 for names the program doesn't use
+    mutable std::unordered_map<std::string, int> uniformLocations;
+
+    int getUniformLocation(const char* uniformName) const;
+    // true if the cached binary was accepted
+    bool loadBinary();
+    // checks the link started by the constructor and caches the binary, blocks until the
+    // driver is done with it
+    void finishLinking() const;
 public:
+    // Loads the cached program binary if it was built from the same sources by the same
+    // driver, otherwise starts compiling and linking. The result is only checked on first
+    // use, so drivers with parallel compilation build every program created in a row at
+    // the same time.
     Shader(std::string const& vsPath, std::string const& fsPath);
     ~Shader();
 
+    Shader(const Shader&) = delete;
+    Shader& operator=(const Shader&) = delete;
+
+    // binds the program unless it is already in use
     void use() const;
+    unsigned int getId() const;
 
     void setFloat(const char* uniformName, float v0) const;
     void setInt(const char* uniformName, int i0) const;
     void setVec2(const char* uniformName, float v0, float v1) const;
+    void setIVec2(const char* uniformName, int i0, int i1) const;
     void setVec3(const char* uniformName, float v0, float v1, float v2) const;
     void setVec3(const char* uniformName, glm::vec3 vec) const;
     void setVec4(const char* uniformName, float v0, float v1, float v2, float v3) const;
     void setVec4(const char* uniformName, glm::vec4 vec) const;
     void setMatrix4(const char* uniformName, const glm::mat4& matrix) const;
 };
+
+namespace shaders {
+    // Loads the entry points of program binaries and parallel compilation where the driver
+    // has them, with the same loader glad got. Without this call shaders are always
+    // compiled from source.
+    void initialize(void* (*loadProc)(const char* name));
+}
@@ -0,0 +1,142 @@
+#include "Simulation.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Profiler.h"
+
+#define CAMERA_GRAVITY 10.0f
+#define CAMERA_SPEED 5.0f
+#define CAMERA_JUMP_SPEED 5.0f
+#define CAMERA_EYE_HEIGHT 2.0f // Height of the eye above the terrain when standing on it.
+
+// Moves the camera by motion, sliding along the world objects it runs into instead of
+// passing through them. The camera's body is an upright capsule from its feet, 2 units
+// below the eye like the terrain expects, to just above the eye. Landed is set if it came
+// to rest on top of something.
+static glm::vec3 moveCamera(const SpatialIndex<const WorldObject*>& objects, glm::vec3 eye, glm::vec3 motion, bool& landed) {
+    const float radius = 0.3f;
+    const float height = 1.6f;
+    // gap kept to whatever was hit so the next sweep doesn't start touching it
+    const float skin = 0.01f;
+    for (int i = 0; i < 3; i++) {
+        float length = glm::length(motion);
+        if (length == 0) {
+            break;
+        }
+        glm::vec3 base = eye - glm::vec3(0, CAMERA_EYE_HEIGHT - radius, 0);
+        SpatialIndex<const WorldObject*>::SweepHit hit;
+        if (!objects.sweepCapsule(base, height, radius, motion, hit)) {
+            eye += motion;
+            break;
+        }
+        float t = std::max(hit.t - skin / length, 0.0f);
+        eye += motion * t;
+        // carry on along the surface with what is left
+        motion *= 1 - t;
+        motion -= hit.normal * glm::dot(motion, hit.normal);
+        landed |= hit.normal.y > 0.7f;
+    }
+    return eye;
+}
+
+Simulation::Simulation(Terrain& terrain, glm::vec3 start) : terrain(terrain) {
+    camera.position = start;
+    SimulationSnapshot& snapshot = snapshots.getBack();
+    snapshot.previous = camera;
+    snapshot.current = camera;
+    snapshot.time = std::chrono::steady_clock::now();
+    snapshots.publish();
+    thread = std::thread(&Simulation::run, this);
+}
+
+Simulation::~Simulation() {
+    running.store(false, std::memory_order_relaxed);
+    thread.join();
+}
+
+void Simulation::tick(const SimulationInput& input) {
+    PROFILE_ZONE("Simulation::tick");
+    const float dt = SIMULATION_TIMESTEP;
+    glm::vec3 forward(-sinf(input.rotation), 0.0f, -cosf(input.rotation));
+    glm::vec3 right(cosf(input.rotation), 0.0f, -sinf(input.rotation));
+    glm::vec3& velocity = camera.velocity;
+    glm::vec3& position = camera.position;
+
+    if (input.jumps != jumpsHandled) {
+        jumpsHandled = input.jumps;
+        velocity.y = CAMERA_JUMP_SPEED;
+    }
+    velocity = glm::vec3(0.0f, velocity.y, 0.0f);
+    float speed = CAMERA_SPEED;
+    float gravity = CAMERA_GRAVITY;
+    if (position.y <= 2.0f) {
+        speed /= 2.0f;
+        gravity /= 6.0f;
+    }
+    if (input.forward) velocity += forward * speed;
+    if (input.back) velocity -= forward * speed;
+    if (input.left) velocity -= right * speed;
+    if (input.right) velocity += right * speed;
+    velocity.y -= gravity * dt;
+
+    bool landed = false;
+    {
+        auto lock = terrain.lockShared();
+        position = moveCamera(terrain.getObjectIndex(), position, velocity * dt, landed);
+    }
+    if (landed) {
+        velocity.y = 0;
+    }
+
+    // the render window always covers the camera's cell, so there is nothing to request
+    glm::vec2 xz(position.x, position.z);
+    float height;
+    terrain.getHeights(&xz, 1, &height);
+    if (position.y <= height + CAMERA_EYE_HEIGHT) {
+        velocity.y = 0;
+        position.y = height + CAMERA_EYE_HEIGHT;
+    }
+}
+
+void Simulation::run() {
+    using clock = std::chrono::steady_clock;
+    const auto step = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(SIMULATION_TIMESTEP));
+    unsigned long long ticks = 0;
+    clock::time_point next = clock::now() + step;
+    while (running.load(std::memory_order_relaxed)) {
+        std::this_thread::sleep_until(next);
+        // run every tick that is due, up to the catch up limit
+        for (int i = 0; i < SIMULATION_MAX_CATCH_UP && next <= clock::now(); i++) {
+            CameraState previous = camera;
+            tick(input.read());
+            SimulationSnapshot& snapshot = snapshots.getBack();
+            snapshot.previous = previous;
+            snapshot.current = camera;
+            snapshot.time = next;
+            snapshot.tick = ++ticks;
+            snapshots.publish();
+            next += step;
+        }
+        // still behind after a long stall, drop the rest rather than spiral
+        clock::time_point now = clock::now();
+        if (next < now) {
+            next = now;
+        }
+    }
+}
+
+void Simulation::setInput(const SimulationInput& frameInput) {
+    input.getBack() = frameInput;
+    input.publish();
+}
+
+CameraState Simulation::getCamera(std::chrono::steady_clock::time_point now) {
+    const SimulationSnapshot& snapshot = snapshots.read();
+    float alpha = std::chrono::duration<float>(now - snapshot.time).count() / SIMULATION_TIMESTEP;
+    alpha = std::min(std::max(alpha, 0.0f), 1.0f);
+    CameraState state;
+    state.position = glm::mix(snapshot.previous.position, snapshot.current.position, alpha);
+    state.velocity = glm::mix(snapshot.previous.velocity, snapshot.current.velocity, alpha);
+    return state;
+}
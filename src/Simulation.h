@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <glm/glm.hpp>
+
+#include "Terrain.h"
+#include "TripleBuffer.h"
+
+#define SIMULATION_TIMESTEP (1.0f / 120.0f) // Seconds of simulated time per tick.
+#define SIMULATION_MAX_CATCH_UP 8 // Ticks run back to back after a stall, the rest of the backlog is dropped.
+
+// What the render thread tells the simulation each frame.
+struct SimulationInput {
+    bool forward = false, back = false, left = false, right = false;
+    // jump presses since the start, each new one makes the camera jump once
+    unsigned int jumps = 0;
+    // heading around the y axis, movement follows it
+    float rotation = 0.0f;
+};
+
+struct CameraState {
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::vec3 velocity = glm::vec3(0.0f);
+};
+
+// The camera after the latest tick and the one before it, for interpolating between.
+struct SimulationSnapshot {
+    CameraState previous;
+    CameraState current;
+    // when the latest tick was due
+    std::chrono::steady_clock::time_point time;
+    unsigned long long tick = 0;
+};
+
+// Runs the camera physics on its own thread at a fixed timestep, so slow frames don't
+// make it jump and it doesn't share a core with rendering. Input comes in and snapshots
+// go out through triple buffers, neither thread waits on the other. Collision and ground
+// queries go through Terrain's thread safe queries.
+class Simulation {
+private:
+    Terrain& terrain;
+    TripleBuffer<SimulationInput> input;
+    TripleBuffer<SimulationSnapshot> snapshots;
+    std::atomic<bool> running{true};
+
+    // simulation thread only
+    CameraState camera;
+    unsigned int jumpsHandled = 0;
+
+    void tick(const SimulationInput& input);
+    void run();
+
+    // declared last so it starts once everything it uses is constructed
+    std::thread thread;
+public:
+    // The terrain must outlive the simulation.
+    Simulation(Terrain& terrain, glm::vec3 start);
+    // stops and joins the simulation thread
+    ~Simulation();
+
+    Simulation(const Simulation&) = delete;
+    Simulation& operator=(const Simulation&) = delete;
+
+    // render thread: hands over this frame's input
+    void setInput(const SimulationInput& input);
+    // render thread: the camera at now, interpolated between the last two ticks, so it
+    // trails the simulation by up to one tick
+    CameraState getCamera(std::chrono::steady_clock::time_point now);
+};
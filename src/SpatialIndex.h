@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "TerrainGenerator.h"
+
+#define SPATIAL_INDEX_GRID 4 // Buckets along each side of a terrain cell.
+
+// Loose uniform grid over boxes placed on the terrain, for proximity and collision queries.
+// Entries are grouped by terrain cell so a cell's objects come and go together as the
+// cell loads and unloads. Each entry is bucketed by the center of its box and queries
+// widen their search by the largest box inserted so far, so an entry lives in exactly one
+// bucket however big it is. Not thread safe.
+template <typename T>
+class SpatialIndex {
+public:
+    struct Entry {
+        glm::vec3 min, max;
+        T value;
+    };
+
+    // first contact of a sweep
+    struct SweepHit {
+        // fraction of the motion covered before touching, in [0, 1]
+        float t;
+        // pointing out of the entry at the contact
+        glm::vec3 normal;
+        const Entry* entry;
+    };
+private:
+    static constexpr int BUCKETS = SPATIAL_INDEX_GRID * SPATIAL_INDEX_GRID;
+    static constexpr float BUCKET_SIZE = static_cast<float>(TERRAIN_CELL_SIZE) / SPATIAL_INDEX_GRID;
+
+    // a cell's entries sorted by bucket, bucket b holds entries [bucketStart[b], bucketStart[b + 1])
+    struct Cell {
+        std::vector<Entry> entries;
+        int bucketStart[BUCKETS + 1];
+    };
+
+    std::unordered_map<CellKey, Cell, CellKeyHash> cells;
+    size_t count = 0;
+    // largest half extent on x or z of any entry inserted, never shrinks
+    float looseness = 0;
+
+    static int floorDiv(int a, int b) {
+        return a / b - (a % b != 0 && (a < 0) != (b < 0));
+    }
+
+    static int getBucketCoordinate(float v) {
+        return static_cast<int>(std::floor(v / BUCKET_SIZE));
+    }
+
+    static float getDistanceSquared(const glm::vec3& point, const glm::vec3& min, const glm::vec3& max) {
+        glm::vec3 d = point - glm::clamp(point, min, max);
+        return glm::dot(d, d);
+    }
+
+    // Calls f(entry) for every entry whose bucket could hold a box overlapping min, max on x and z.
+    template <typename F>
+    void forEachCandidate(const glm::vec3& min, const glm::vec3& max, F f) const {
+        int bx0 = getBucketCoordinate(min.x - looseness), bx1 = getBucketCoordinate(max.x + looseness);
+        int bz0 = getBucketCoordinate(min.z - looseness), bz1 = getBucketCoordinate(max.z + looseness);
+        for (int cx = floorDiv(bx0, SPATIAL_INDEX_GRID); cx <= floorDiv(bx1, SPATIAL_INDEX_GRID); cx++) {
+            for (int cz = floorDiv(bz0, SPATIAL_INDEX_GRID); cz <= floorDiv(bz1, SPATIAL_INDEX_GRID); cz++) {
+                auto it = cells.find(CellKey{cx, cz});
+                if (it == cells.end()) {
+                    continue;
+                }
+                const Cell& cell = it->second;
+                int i0 = std::max(bx0 - cx * SPATIAL_INDEX_GRID, 0), i1 = std::min(bx1 - cx * SPATIAL_INDEX_GRID, SPATIAL_INDEX_GRID - 1);
+                int j0 = std::max(bz0 - cz * SPATIAL_INDEX_GRID, 0), j1 = std::min(bz1 - cz * SPATIAL_INDEX_GRID, SPATIAL_INDEX_GRID - 1);
+                for (int i = i0; i <= i1; i++) {
+                    // buckets of a row are contiguous
+                    int first = cell.bucketStart[i * SPATIAL_INDEX_GRID + j0];
+                    int last = cell.bucketStart[i * SPATIAL_INDEX_GRID + j1 + 1];
+                    for (int e = first; e < last; e++) {
+                        f(cell.entries[e]);
+                    }
+                }
+            }
+        }
+    }
+
+    // earliest t in [0, tMax) at which origin + t * dir is within r of the sphere center
+    static bool raySphere(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3& center, float r, float& tMax) {
+        glm::vec3 o = origin - center;
+        float a = glm::dot(dir, dir);
+        float b = glm::dot(o, dir);
+        float c = glm::dot(o, o) - r * r;
+        float disc = b * b - a * c;
+        if (a == 0 || disc < 0) {
+            return false;
+        }
+        float t = (-b - std::sqrt(disc)) / a;
+        if (t < 0 || t >= tMax) {
+            return false;
+        }
+        tMax = t;
+        return true;
+    }
+
+    // same against the cylinder of radius r around the box edge along axis k through corner
+    static bool rayEdge(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3& corner, int k, float lo, float hi, float r, float& tMax) {
+        int a = (k + 1) % 3, b = (k + 2) % 3;
+        float oa = origin[a] - corner[a], ob = origin[b] - corner[b];
+        float qa = dir[a] * dir[a] + dir[b] * dir[b];
+        float qb = oa * dir[a] + ob * dir[b];
+        float qc = oa * oa + ob * ob - r * r;
+        float disc = qb * qb - qa * qc;
+        if (qa == 0 || disc < 0) {
+            return false;
+        }
+        float t = (-qb - std::sqrt(disc)) / qa;
+        float along = origin[k] + t * dir[k];
+        if (t < 0 || t >= tMax || along < lo || along > hi) {
+            return false;
+        }
+        tMax = t;
+        return true;
+    }
+
+    // same against the box
+    static bool rayBox(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3& min, const glm::vec3& max, float& tMax) {
+        float tNear = 0, tFar = tMax;
+        for (int k = 0; k < 3; k++) {
+            if (dir[k] == 0) {
+                if (origin[k] < min[k] || origin[k] > max[k]) {
+                    return false;
+                }
+                continue;
+            }
+            float t0 = (min[k] - origin[k]) / dir[k], t1 = (max[k] - origin[k]) / dir[k];
+            tNear = std::max(tNear, std::min(t0, t1));
+            tFar = std::min(tFar, std::max(t0, t1));
+        }
+        if (tNear > tFar || tNear >= tMax) {
+            return false;
+        }
+        tMax = tNear;
+        return true;
+    }
+
+    // Sweeps a sphere of radius r from origin along dir against the box. The sphere touches
+    // the box where its center enters the box grown by r with rounded edges and corners,
+    // which is the union of three slabs, twelve edge cylinders and eight corner spheres.
+    static bool sweepSphereBox(const glm::vec3& origin, const glm::vec3& dir, float r, const glm::vec3& min, const glm::vec3& max, float& tMax) {
+        glm::vec3 away = origin - glm::clamp(origin, min, max);
+        if (glm::dot(away, away) <= r * r) {
+            // Already touching, which only blocks moving further in. A center inside the box
+            // is let go so whatever ends up inside an object can get out again.
+            if (glm::dot(away, dir) < 0) {
+                tMax = 0;
+                return true;
+            }
+            return false;
+        }
+        bool hit = false;
+        for (int k = 0; k < 3; k++) {
+            glm::vec3 grow(0);
+            grow[k] = r;
+            hit |= rayBox(origin, dir, min - grow, max + grow, tMax);
+        }
+        for (int k = 0; k < 3; k++) {
+            int a = (k + 1) % 3, b = (k + 2) % 3;
+            for (int corner = 0; corner < 4; corner++) {
+                glm::vec3 c = min;
+                c[a] = (corner & 1) ? max[a] : min[a];
+                c[b] = (corner & 2) ? max[b] : min[b];
+                hit |= rayEdge(origin, dir, c, k, min[k], max[k], r, tMax);
+            }
+        }
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec3 c((corner & 1) ? max.x : min.x, (corner & 2) ? max.y : min.y, (corner & 4) ? max.z : min.z);
+            hit |= raySphere(origin, dir, c, r, tMax);
+        }
+        return hit;
+    }
+public:
+    // Adds the entries of a terrain cell, replacing any the cell already had.
+    void insertCell(CellKey key, const std::vector<Entry>& entries) {
+        removeCell(key);
+        Cell& cell = cells[key];
+        // counting sort by bucket
+        std::vector<int> buckets(entries.size());
+        int counts[BUCKETS] = {};
+        for (size_t e = 0; e < entries.size(); e++) {
+            glm::vec3 center = (entries[e].min + entries[e].max) * 0.5f;
+            int i = std::min(std::max(getBucketCoordinate(center.x) - key.x * SPATIAL_INDEX_GRID, 0), SPATIAL_INDEX_GRID - 1);
+            int j = std::min(std::max(getBucketCoordinate(center.z) - key.z * SPATIAL_INDEX_GRID, 0), SPATIAL_INDEX_GRID - 1);
+            buckets[e] = i * SPATIAL_INDEX_GRID + j;
+            counts[buckets[e]]++;
+            // entries centered outside the cell go into its border buckets, further from their bucket
+            glm::vec3 half = (entries[e].max - entries[e].min) * 0.5f;
+            glm::vec2 cellMin(key.x * TERRAIN_CELL_SIZE, key.z * TERRAIN_CELL_SIZE);
+            glm::vec2 c(center.x, center.z);
+            glm::vec2 outside = glm::abs(c - glm::clamp(c, cellMin, cellMin + glm::vec2(TERRAIN_CELL_SIZE)));
+            looseness = std::max(looseness, std::max(half.x + outside.x, half.z + outside.y));
+        }
+        cell.bucketStart[0] = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            cell.bucketStart[b + 1] = cell.bucketStart[b] + counts[b];
+        }
+        std::vector<int> next(cell.bucketStart, cell.bucketStart + BUCKETS);
+        cell.entries.resize(entries.size());
+        for (size_t e = 0; e < entries.size(); e++) {
+            cell.entries[next[buckets[e]]++] = entries[e];
+        }
+        count += entries.size();
+    }
+
+    void removeCell(CellKey key) {
+        auto it = cells.find(key);
+        if (it != cells.end()) {
+            count -= it->second.entries.size();
+            cells.erase(it);
+        }
+    }
+
+    void clear() {
+        cells.clear();
+        count = 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    // calls f(entry) for every entry whose box overlaps min, max
+    template <typename F>
+    void queryBox(const glm::vec3& min, const glm::vec3& max, F f) const {
+        forEachCandidate(min, max, [&](const Entry& entry) {
+            if (glm::all(glm::lessThanEqual(entry.min, max)) && glm::all(glm::lessThanEqual(min, entry.max))) {
+                f(entry);
+            }
+        });
+    }
+
+    // calls f(entry) for every entry whose box is within radius of center
+    template <typename F>
+    void queryRadius(const glm::vec3& center, float radius, F f) const {
+        forEachCandidate(center - glm::vec3(radius), center + glm::vec3(radius), [&](const Entry& entry) {
+            if (getDistanceSquared(center, entry.min, entry.max) <= radius * radius) {
+                f(entry);
+            }
+        });
+    }
+
+    // Entry whose box is closest to point, nullptr if none is within maxDistance.
+    const Entry* findNearest(const glm::vec3& point, float maxDistance) const {
+        // grow the search until it holds an entry, anything closer than the best
+        // candidate lies within the searched radius so the best one is the nearest
+        float radius = std::min(BUCKET_SIZE, maxDistance);
+        while (true) {
+            const Entry* best = nullptr;
+            float bestDistance = radius * radius;
+            queryRadius(point, radius, [&](const Entry& entry) {
+                float d = getDistanceSquared(point, entry.min, entry.max);
+                if (d <= bestDistance) {
+                    bestDistance = d;
+                    best = &entry;
+                }
+            });
+            if (best != nullptr || radius >= maxDistance) {
+                return best;
+            }
+            radius = std::min(radius * 2, maxDistance);
+        }
+    }
+
+    // Sweeps an upright capsule, the segment from base to base + (0, height, 0) grown by
+    // radius, along motion. Returns false if it moves freely, otherwise hit is the first
+    // contact. A capsule already touching an entry hits it at t = 0.
+    bool sweepCapsule(const glm::vec3& base, float height, float radius, const glm::vec3& motion, SweepHit& hit) const {
+        glm::vec3 min = glm::min(base, base + motion) - glm::vec3(radius);
+        glm::vec3 max = glm::max(base, base + motion) + glm::vec3(radius, height + radius, radius);
+        hit.t = 1;
+        hit.entry = nullptr;
+        queryBox(min, max, [&](const Entry& entry) {
+            // the capsule touches the box when its base sphere touches the box stretched down by height
+            glm::vec3 boxMin(entry.min.x, entry.min.y - height, entry.min.z);
+            if (sweepSphereBox(base, motion, radius, boxMin, entry.max, hit.t)) {
+                hit.entry = &entry;
+            }
+        });
+        if (hit.entry == nullptr) {
+            return false;
+        }
+        glm::vec3 contact = base + motion * hit.t;
+        glm::vec3 boxMin(hit.entry->min.x, hit.entry->min.y - height, hit.entry->min.z);
+        glm::vec3 away = contact - glm::clamp(contact, boxMin, hit.entry->max);
+        float length = glm::length(away);
+        hit.normal = length > 1e-6f ? away / length : (glm::length(motion) > 0 ? -glm::normalize(motion) : glm::vec3(0, 1, 0));
+        return true;
+    }
+};
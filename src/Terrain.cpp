@@ -1,173 +1,798 @@
 #include "Terrain.h"
 
 #include <iostream>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <limits>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glad/glad.h>
 
-#include "Math.h"
 
 #include "Mesh.h"
 #include "Shader.h"
+#include "Profiler.h"
 
-static const VertexAttribSet terrainAttributeSet = {
-    {GL_FLOAT, 3, sizeof(float)},
-    {GL_FLOAT, 3, sizeof(float)},
-    {GL_FLOAT, 2, sizeof(float)},
-    {GL_FLOAT, 1, sizeof(float)}
+// lattice i, j of the grid mesh shared by cells in heightmap mode
+static const VertexAttribSet gridAttributeSet = {
+    {GL_UNSIGNED_BYTE, 2, sizeof(unsigned char), false, true}
 };
 
-enum TextureID {
-    GRASS=0,
-    STONE=1,
-    DIRT=2,
-    COBBLESTONE=24,
-    SAND=26,
-    GRAVEL=27
+// matches the layout of TerrainVertex
+static const VertexAttribSet terrainAttributeSet = {
+    {GL_UNSIGNED_BYTE, 2, sizeof(unsigned char), false, true},  // lattice i, j
+    {GL_BYTE, 2, sizeof(signed char), true, false},             // octahedral normal
+    {GL_SHORT, 1, sizeof(short), false, false},                 // quantized height
+    {GL_UNSIGNED_BYTE, 2, sizeof(unsigned char), false, true}   // texture index, unused
 };
 
-static float getTexture(float height) {
-    if (height < 0) return SAND;
-    else if (height < 2) return STONE;
-    else if (height < 4) return DIRT;
-    else return GRASS;
-}
-
-TerrainCell::TerrainCell(int x, int z, int seed) : x(x), z(z) {
-    for (int i = 0; i < TERRAIN_POINTS_PER_CELL + 1; i++) {
-        for (int j = 0; j < TERRAIN_POINTS_PER_CELL + 1; j++) {
-            float s = 43.45231f;
-            float f = math::getPerlinNoise(
-                0.4837f + (x * TERRAIN_CELL_SIZE + static_cast<float>(i) / TERRAIN_RESOLUTION) / s, 
-                0.9482f + (z * TERRAIN_CELL_SIZE + static_cast<float>(j) / TERRAIN_RESOLUTION) / s, 
-                seed
-            );
-            latticePoints[i][j] = f * f * 52 - 2;
-        }
-    }
-    const int floatsPerLatticeCell = 54;
-    float terrainData[TERRAIN_POINTS_PER_CELL * TERRAIN_POINTS_PER_CELL * floatsPerLatticeCell];
-    int ti = 0;
-    for (int i = 0; i < TERRAIN_POINTS_PER_CELL; i++) {
-        for (int j = 0; j < TERRAIN_POINTS_PER_CELL; j++) {
-            float s = 1.0f / static_cast<float>(TERRAIN_RESOLUTION);
-            float fi = static_cast<float>(i) * s, fj = static_cast<float>(j) * s;
-            glm::vec3 diag(1.0f, latticePoints[i + 1][j + 1] - latticePoints[i][j], 1.0f);
-            glm::vec3 right(1.0f, latticePoints[i + 1][j] - latticePoints[i][j], 0.0f);
-            glm::vec3 up(0.0f, latticePoints[i][j + 1] - latticePoints[i][j], 1.0f);
-            glm::vec3 norm1 = glm::normalize(glm::cross(diag, right));
-            if (norm1.y < 0) norm1 = -norm1;
-            glm::vec3 norm2 = glm::normalize(glm::cross(diag, up));
-            if (norm2.y < 0) norm2 = -norm2;
-            // std::cout << norm1.x << ", " << norm1.y << ", " << norm1.z << "\n";
-            float wi = fi - i / TERRAIN_RESOLUTION;
-            float wj = fj - j / TERRAIN_RESOLUTION;
-            float triangles[floatsPerLatticeCell] = {
-                fi,     latticePoints[i][j],         fj,      norm1.x, norm1.y, norm1.z,  wi,     wj,       getTexture(latticePoints[i][j]),        //getTexture(latticePoints[i][j]),//
-                fi + s, latticePoints[i + 1][j],     fj,      norm1.x, norm1.y, norm1.z,  wi + s, wj,       getTexture(latticePoints[i + 1][j]),    //getTexture(latticePoints[i][j]),//
-                fi + s, latticePoints[i + 1][j + 1], fj + s,  norm1.x, norm1.y, norm1.z,  wi + s, wj + s,   getTexture(latticePoints[i + 1][j + 1]),//getTexture(latticePoints[i][j]),//
-                fi,     latticePoints[i][j],         fj,      norm2.x, norm2.y, norm2.z,  wi,     wj,       getTexture(latticePoints[i][j]),        //getTexture(latticePoints[i][j]),//
-                fi,     latticePoints[i][j + 1],     fj + s,  norm2.x, norm2.y, norm2.z,  wi,     wj + s,   getTexture(latticePoints[i][j + 1]),    //getTexture(latticePoints[i][j]),//
-                fi + s, latticePoints[i + 1][j + 1], fj + s,  norm2.x, norm2.y, norm2.z,  wi + s, wj + s,   getTexture(latticePoints[i + 1][j + 1]),//getTexture(latticePoints[i][j]),//
+static Model& getModel(ObjectType type) {
+    switch (type) {
+        case ObjectType::TREE:
+        default:
+            return models::TREE;
+    }
+}
+
+// Builds the triangle lists over a cell's vertex grid for every level of detail and
+// stitch mask, appending them to indices. At level n every 2^n-th lattice point is used.
+// Bit 0/1/2/3 of the mask marks the -x/+x/-z/+z neighbour as one level coarser; on those
+// edges every other vertex is collapsed onto its predecessor so the edge matches the
+// coarser neighbour and no cracks open up. The last vertex of every triangle is the
+// (i + step, j + step) corner, which provides the flat texture index.
+static void buildLodIndices(std::vector<unsigned short>& indices, IndexRange ranges[TERRAIN_LOD_LEVELS][16]) {
+    const int n = TERRAIN_POINTS_PER_CELL;
+    const int side = n + 1;
+    for (int lod = 0; lod < TERRAIN_LOD_LEVELS; lod++) {
+        const int step = 1 << lod;
+        for (int mask = 0; mask < 16; mask++) {
+            auto vertex = [&](int i, int j) {
+                if (((mask & 1) && i == 0) || ((mask & 2) && i == n)) j -= j % (2 * step);
+                if (((mask & 4) && j == 0) || ((mask & 8) && j == n)) i -= i % (2 * step);
+                return static_cast<unsigned short>(i * side + j);
+            };
+            auto triangle = [&](unsigned short a, unsigned short b, unsigned short c) {
+                if (a != b && b != c && a != c) {
+                    indices.insert(indices.end(), {a, b, c});
+                }
             };
-            for (int i = 0; i < floatsPerLatticeCell; i++) {
-                terrainData[ti + i] = triangles[i];
+            ranges[lod][mask].first = static_cast<unsigned int>(indices.size());
+            for (int i = 0; i < n; i += step) {
+                for (int j = 0; j < n; j += step) {
+                    unsigned short v00 = vertex(i, j);
+                    unsigned short v10 = vertex(i + step, j);
+                    unsigned short v01 = vertex(i, j + step);
+                    unsigned short v11 = vertex(i + step, j + step);
+                    triangle(v00, v10, v11);
+                    triangle(v00, v01, v11);
+                }
             }
-            ti += floatsPerLatticeCell;
+            ranges[lod][mask].count = static_cast<unsigned int>(indices.size()) - ranges[lod][mask].first;
         }
     }
-    mesh = std::make_unique<Mesh>(terrainData, TERRAIN_POINTS_PER_CELL * TERRAIN_POINTS_PER_CELL * 6, terrainAttributeSet);
+}
 
-    // populate with trees
-    for (int i = 0; i < 2; i++) {
-        float wx = math::randf(
-            x * TERRAIN_CELL_SIZE, 
-            (x + 1) * TERRAIN_CELL_SIZE), 
-        wz = math::randf(z * TERRAIN_CELL_SIZE, (z + 1) * TERRAIN_CELL_SIZE);
-        // put a tree there
-        float h = getHeight(wx, wz);
-        if (h < 1.0f) {
-            continue;
-        }
-        WorldObject tree = {
-            models::TREE,
-            glm::vec3(wx,getHeight(wx,wz),wz),
-            glm::vec3(1,1,1),
+TerrainCell::TerrainCell(int x, int z, int seed, int lod) : TerrainCell(terraingen::generateCell(x, z, seed, lod)) {}
+
+TerrainCell::TerrainCell(TerrainCellData data) : data(std::move(data)) {
+    PROFILE_ZONE("TerrainCell::TerrainCell");
+    createObjects();
+}
+
+void TerrainCell::createObjects() {
+    boundsMin = data.boundsMin;
+    boundsMax = data.boundsMax;
+    objects.clear();
+    for (const ObjectPlacement& placement : data.objects) {
+        WorldObject object = {
+            getModel(placement.type),
+            placement.pos,
+            placement.scale,
             glm::vec3(0,0,0),
             0,
-        }; 
-        objects.push_back(tree);
+        };
+        objects.push_back(object);
+        glm::vec3 objectMin, objectMax;
+        object.getBounds(objectMin, objectMax);
+        boundsMin = glm::min(boundsMin, objectMin);
+        boundsMax = glm::max(boundsMax, objectMax);
     }
 }
 
-float TerrainCell::getHeight(float x, float z) const {
-    float px = x - static_cast<float>(this->x * TERRAIN_CELL_SIZE);
-    float pz = z - static_cast<float>(this->z * TERRAIN_CELL_SIZE);
-    if (px < 0 || px >= TERRAIN_CELL_SIZE || pz < 0 || pz >= TERRAIN_CELL_SIZE) {
-        throw std::runtime_error("TerrainCell::getHeight: Coordinate out of range of this terrain cell (querying: "
-                                     + std::to_string(x) + ", " + std::to_string(z) + " in terrain cell: " + std::to_string(this->x) + ", " + std::to_string(this->z) + ")");
+TerrainCell::~TerrainCell() {
+    if (arena != nullptr) {
+        arena->release(arenaSlot);
+    }
+    if (atlas != nullptr) {
+        atlas->release(atlasSlot);
     }
-    int x0 = static_cast<int>(px * TERRAIN_RESOLUTION);
-    int x1 = x0 + 1;
-    int z0 = static_cast<int>(pz * TERRAIN_RESOLUTION);
-    int z1 = z0 + 1;
-    float h00 = latticePoints[x0][z0];
-    float h01 = latticePoints[x0][z1];
-    float h10 = latticePoints[x1][z0];
-    float h11 = latticePoints[x1][z1];
-    return (h00 + h01 + h10 + h11) / 4;
 }
 
-Mesh& TerrainCell::getMesh() {
-    return *mesh;
+void TerrainCell::upload(VertexArena& arena) {
+    arenaSlot = arena.allocate();
+    if (arenaSlot < 0) {
+        throw std::runtime_error("TerrainCell::upload: Vertex arena is full");
+    }
+    this->arena = &arena;
+    arena.upload(arenaSlot, data.vertices.data(), glm::ivec2(data.x, data.z));
+    data.vertices.clear();
+    data.vertices.shrink_to_fit();
+    data.heightmap.clear();
+    data.heightmap.shrink_to_fit();
 }
 
-void TerrainCell::render(Shader& terrainShader, Shader& objectShader) const {
-    // render terrain mesh
-    glm::mat4 model(1.0f);
-    model = glm::translate(model, glm::vec3(x * TERRAIN_CELL_SIZE, 0, z * TERRAIN_CELL_SIZE));
-    terrainShader.use();
-    terrainShader.setMatrix4("model", model);
-    textures::MINECRAFT->bind();
-    mesh->render();
-    // render world objects
+void TerrainCell::upload(HeightmapAtlas& atlas) {
+    atlasSlot = atlas.allocate();
+    if (atlasSlot < 0) {
+        throw std::runtime_error("TerrainCell::upload: Heightmap atlas is full");
+    }
+    this->atlas = &atlas;
+    atlas.upload(atlasSlot, data.heightmap.data());
+    data.vertices.clear();
+    data.vertices.shrink_to_fit();
+}
+
+void TerrainCell::reuploadHeightmap() {
+    if (atlas != nullptr) {
+        atlas->upload(atlasSlot, data.heightmap.data());
+    }
+}
+
+bool TerrainCell::isUploaded() const {
+    return arena != nullptr || atlas != nullptr;
+}
+
+void TerrainCell::setHeights(const float* apron, const TerrainEditRegion& region, int seed) {
+    PROFILE_ZONE("TerrainCell::setHeights");
+    const int side = TERRAIN_POINTS_PER_CELL + 1;
+    // lattice point i, j reads apron points i to i + 2, j to j + 2
+    int i0 = std::max(region.i0 - 2, 0), i1 = std::min(region.i1, side - 1);
+    int j0 = std::max(region.j0 - 2, 0), j1 = std::min(region.j1, side - 1);
+    bool coarse = data.lod != 0;
+    if (coarse) {
+        // the lattice between a coarse cell's samples was interpolated, all of it changes
+        i0 = j0 = 0;
+        i1 = j1 = side - 1;
+        data.lod = 0;
+    }
+    terraingen::setHeights(data, apron);
+    terraingen::placeObjects(data, seed);
+    createObjects();
+
+    if (arena != nullptr) {
+        // one upload per row of changed vertices
+        std::vector<TerrainVertex> row(j1 - j0 + 1);
+        for (int i = i0; i <= i1; i++) {
+            for (int j = j0; j <= j1; j++) {
+                row[j - j0] = terraingen::buildVertex(apron, i, j);
+            }
+            arena->update(arenaSlot, row.data(), i * side + j0, j1 - j0 + 1);
+        }
+    } else if (atlas != nullptr) {
+        if (coarse) {
+            atlas->upload(atlasSlot, data.heightmap.data());
+        } else {
+            atlas->upload(atlasSlot, data.heightmap.data(), region.i0, region.j0, region.i1 - region.i0 + 1, region.j1 - region.j0 + 1);
+        }
+    } else if (!data.vertices.empty()) {
+        for (int i = i0; i <= i1; i++) {
+            for (int j = j0; j <= j1; j++) {
+                data.vertices[i * side + j] = terraingen::buildVertex(apron, i, j);
+            }
+        }
+    }
+}
+
+int TerrainCell::getX() const {
+    return data.x;
+}
+
+int TerrainCell::getZ() const {
+    return data.z;
+}
+
+int TerrainCell::getLod() const {
+    return data.lod;
+}
+
+float TerrainCell::getHeight(float x, float z, glm::vec3* normal) const {
+    return terraingen::getHeight(data, x, z, normal);
+}
+
+float TerrainCell::getLatticePoint(int i, int j) const {
+    return data.latticePoints[i][j];
+}
+
+const glm::vec3& TerrainCell::getBoundsMin() const {
+    return boundsMin;
+}
+
+const glm::vec3& TerrainCell::getBoundsMax() const {
+    return boundsMax;
+}
+
+void TerrainCell::submit(DrawQueue& queue, const Shader& terrainShader, const Mesh* grid, IndexRange range) const {
+    if (arena != nullptr) {
+        // the arena knows the cell's origin from its slot
+        arena->add(arenaSlot, range);
+        return;
+    }
+    queue.submit(terrainShader, *textures::MINECRAFT, *grid, range, [this](const Shader& shader) {
+        glm::mat4 model(1.0f);
+        model = glm::translate(model, glm::vec3(data.x * TERRAIN_CELL_SIZE, 0, data.z * TERRAIN_CELL_SIZE));
+        shader.setMatrix4("model", model);
+        glm::ivec2 origin = atlas->getTileOrigin(atlasSlot);
+        shader.setIVec2("tileOrigin", origin.x, origin.y);
+    });
+}
+
+const std::vector<WorldObject>& TerrainCell::getObjects() const {
+    return objects;
+}
+
+void TerrainCell::collectObjects(InstancedRenderer& renderer, const Frustum& frustum, TerrainRenderStats& stats) const {
     for (auto const& object : objects) {
-        object.render(objectShader);
+        glm::vec3 objectMin, objectMax;
+        object.getBounds(objectMin, objectMax);
+        if (!frustum.intersects(objectMin, objectMax)) {
+            stats.objectsCulled++;
+            continue;
+        }
+        renderer.add(object);
+        stats.objectsDrawn++;
+    }
+}
+
+Terrain::Terrain(int seed, TerrainRenderMode renderMode, RegionStore* regionStore) 
+    : cells(TERRAIN_CACHE_CAPACITY), seed(seed), regionStore(regionStore), edits(seed, regionStore), renderMode(renderMode), renderDistance(TERRAIN_RENDER_DISTANCE) {
+    setCacheCapacity(TERRAIN_CACHE_CAPACITY);
+    cells.setEvictionCallback([this](const CellKey& key, std::unique_ptr<TerrainCell>&) {
+        objectIndex.removeCell(key);
+    });
+    // edits run with cellsMutex held, see edit
+    edits.setHeightSource([this](CellKey key, float* apron) {
+        return fillApron(key, apron);
+    });
+}
+
+Terrain::~Terrain() {
+    {
+        // running generators finish their cell and stop
+        std::lock_guard<std::mutex> lock(requestsMutex);
+        queued.clear();
+    }
+    saveEdits();
+}
+
+void Terrain::setRenderDistance(int distance) {
+    renderDistance = distance;
+    setCacheCapacity(cells.getCapacity());
+}
+
+int Terrain::getRenderDistance() const {
+    return renderDistance;
+}
+
+int Terrain::getLodLevel(int dx, int dz) {
+    int distance = std::max(std::abs(dx), std::abs(dz));
+    // thresholds double per level so neighbouring cells never differ by more than one level
+    int lod = 0;
+    while (lod < TERRAIN_LOD_LEVELS - 1 && distance >= (TERRAIN_LOD_RADIUS << lod)) {
+        lod++;
+    }
+    return lod;
+}
+
+void Terrain::setCacheCapacity(size_t capacity) {
+    std::unique_lock<std::shared_mutex> lock(cellsMutex);
+    // the render window grown by the prefetch margin on every side, where motion can take it
+    const size_t window = (2 * (renderDistance + TERRAIN_PREFETCH_CELLS) + 1) * (2 * (renderDistance + TERRAIN_PREFETCH_CELLS) + 1);
+    cells.setCapacity(capacity < window ? window : capacity);
+    if (vertexArena != nullptr) {
+        // copied over on the GPU, nothing to upload again
+        vertexArena->reserve(static_cast<int>(cells.getCapacity()));
+    }
+    if (heightmapAtlas != nullptr && heightmapAtlas->reserve(static_cast<int>(cells.getCapacity()))) {
+        // the atlas texture was replaced, every resident cell has to upload its heights again
+        cells.forEach([](const CellKey&, std::unique_ptr<TerrainCell>& cell) {
+            cell->reuploadHeightmap();
+        });
+    }
+}
+
+size_t Terrain::getCacheCapacity() const {
+    return cells.getCapacity();
+}
+
+size_t Terrain::getCacheSize() const {
+    return cells.size();
+}
+
+const CacheStats& Terrain::getCacheStats() const {
+    return cells.getStats();
+}
+
+TerrainRenderMode Terrain::getRenderMode() const {
+    return renderMode;
+}
+
+const TerrainRenderStats& Terrain::getRenderStats() const {
+    return renderStats;
+}
+
+std::shared_lock<std::shared_mutex> Terrain::lockShared() const {
+    return std::shared_lock<std::shared_mutex>(cellsMutex);
+}
+
+const SpatialIndex<const WorldObject*>& Terrain::getObjectIndex() const {
+    return objectIndex;
+}
+
+void Terrain::setCameraMotion(const glm::vec3& velocity, const glm::vec3& forward) {
+    cameraVelocity = velocity;
+    cameraForward = forward;
+}
+
+void Terrain::setWaitForCells(bool wait) {
+    waitForCells = wait;
+}
+
+float Terrain::getRequestDistance(int cx, int cz, float x, float z) const {
+    glm::vec2 toCell((cx + 0.5f) * TERRAIN_CELL_SIZE - x, (cz + 0.5f) * TERRAIN_CELL_SIZE - z);
+    float length = glm::length(toCell);
+    float distance = length / TERRAIN_CELL_SIZE;
+    if (length == 0) {
+        return distance;
+    }
+    glm::vec2 direction = toCell / length;
+    // only the heading counts, looking up or down doesn't change which cells are ahead
+    glm::vec2 forward(cameraForward.x, cameraForward.z);
+    if (glm::length(forward) > 0) {
+        distance *= 1 - TERRAIN_VIEW_PRIORITY * std::max(glm::dot(direction, glm::normalize(forward)), 0.0f);
+    }
+    glm::vec2 velocity(cameraVelocity.x, cameraVelocity.z);
+    float speed = glm::length(velocity);
+    if (speed > 0) {
+        float weight = TERRAIN_MOTION_PRIORITY * std::min(speed / TERRAIN_MOTION_FULL_SPEED, 1.0f);
+        distance *= 1 - weight * std::max(glm::dot(direction, velocity / speed), 0.0f);
+    }
+    return distance;
+}
+
+void Terrain::requestCells(const std::vector<CellRequest>& requests, bool cancelOthers) {
+    std::lock_guard<std::mutex> lock(requestsMutex);
+    if (cancelOthers) {
+        queued.clear();
+    }
+    for (const CellRequest& request : requests) {
+        auto taken = inFlight.find(request.key);
+        if (taken != inFlight.end() && taken->second <= request.lod) {
+            // already coming at this level or finer
+            continue;
+        }
+        auto it = queued.find(request.key);
+        if (it == queued.end() || it->second.lod > request.lod) {
+            queued[request.key] = request;
+        }
+    }
+    // one generator per thread at most, each works through the queue on its own
+    while (generators < workers.getNumThreads() && generators < queued.size()) {
+        generators++;
+        workers.submit([this]() {
+            generateQueued();
+        });
+    }
+}
+
+void Terrain::generateQueued() {
+    int seed = this->seed;
+    RegionStore* store = regionStore;
+    while (true) {
+        CellKey key;
+        int lod;
+        {
+            std::lock_guard<std::mutex> lock(requestsMutex);
+            // the queue is a few hundred cells at most and rebuilt every frame, a scan is
+            // cheaper than keeping a heap ordered
+            auto nearest = queued.end();
+            for (auto it = queued.begin(); it != queued.end(); it++) {
+                if (nearest == queued.end() || it->second.distance < nearest->second.distance) {
+                    nearest = it;
+                }
+            }
+            if (nearest == queued.end()) {
+                generators--;
+                if (generators == 0) {
+                    generatorsDone.notify_all();
+                }
+                return;
+            }
+            key = nearest->first;
+            lod = nearest->second.lod;
+            queued.erase(nearest);
+            inFlight[key] = lod;
+        }
+        TerrainCellData data;
+        // saved cells are always full detail, which serves any requested level
+        if (store == nullptr || !store->load(key.x, key.z, data)) {
+            data = terraingen::generateCell(key.x, key.z, seed, lod);
+            if (store != nullptr) {
+                store->save(data);
+            }
+        }
+        auto cell = std::make_unique<TerrainCell>(std::move(data));
+        std::lock_guard<std::mutex> lock(completedMutex);
+        completed.push_back(std::move(cell));
+    }
+}
+
+void Terrain::uploadCompleted(float budgetMs) {
+    PROFILE_ZONE("Terrain::uploadCompleted");
+    std::vector<std::unique_ptr<TerrainCell>> ready;
+    {
+        std::lock_guard<std::mutex> lock(completedMutex);
+        ready.swap(completed);
+    }
+    if (cellIndices == nullptr) {
+        std::vector<unsigned short> indices;
+        buildLodIndices(indices, lodRanges);
+        cellIndices = std::make_unique<IndexBuffer>(indices.data(), static_cast<int>(indices.size()));
+    }
+    if (renderMode == TerrainRenderMode::MESH && vertexArena == nullptr) {
+        const int side = TERRAIN_POINTS_PER_CELL + 1;
+        vertexArena = std::make_unique<VertexArena>(terrainAttributeSet, side * side, static_cast<int>(cells.getCapacity()), cellIndices.get());
+    }
+    if (renderMode == TerrainRenderMode::HEIGHTMAP && gridMesh == nullptr) {
+        const int side = TERRAIN_POINTS_PER_CELL + 1;
+        std::vector<unsigned char> grid;
+        for (int i = 0; i < side; i++) {
+            for (int j = 0; j < side; j++) {
+                grid.push_back(static_cast<unsigned char>(i));
+                grid.push_back(static_cast<unsigned char>(j));
+            }
+        }
+        gridMesh = std::make_unique<Mesh>(grid.data(), side * side, gridAttributeSet, cellIndices.get());
+        heightmapAtlas = std::make_unique<HeightmapAtlas>(TERRAIN_HEIGHTMAP_SIZE, static_cast<int>(cells.getCapacity()));
+    }
+    auto start = std::chrono::steady_clock::now();
+    size_t i = 0;
+    for (; i < ready.size(); i++) {
+        // always upload at least one cell so generation makes progress on slow frames
+        std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (i > 0 && elapsed.count() >= budgetMs) {
+            break;
+        }
+        CellKey key{ready[i]->getX(), ready[i]->getZ()};
+        {
+            std::lock_guard<std::mutex> lock(requestsMutex);
+            auto request = inFlight.find(key);
+            // saved cells come back at full detail whatever level was asked for
+            if (request != inFlight.end() && request->second >= ready[i]->getLod()) {
+                inFlight.erase(request);
+            }
+        }
+        const float* edited = edits.find(key);
+        if (edited != nullptr) {
+            // edited after it was queued, or generated over an edit that was never saved
+            ready[i] = std::make_unique<TerrainCell>(terraingen::buildCell(key.x, key.z, seed, edited));
+        }
+        TerrainCell& cell = *ready[i];
+        auto resident = cells.peek(key);
+        if (resident != nullptr && (*resident)->getLod() <= cell.getLod()) {
+            // a finer version of this cell arrived first, drop this one
+            continue;
+        }
+        {
+            // insert first so an evicted cell frees its atlas slot before this one takes one
+            std::unique_lock<std::shared_mutex> lock(cellsMutex);
+            cells.put(key, std::move(ready[i]));
+            indexObjects(cell);
+        }
+        if (renderMode == TerrainRenderMode::HEIGHTMAP) {
+            cell.upload(*heightmapAtlas);
+        } else {
+            cell.upload(*vertexArena);
+        }
+        renderStats.cellsUploaded++;
+    }
+    if (i < ready.size()) {
+        // out of budget, hand the rest back for the next frame
+        std::lock_guard<std::mutex> lock(completedMutex);
+        for (; i < ready.size(); i++) {
+            completed.push_back(std::move(ready[i]));
+        }
+    }
+}
+
+void Terrain::indexObjects(const TerrainCell& cell) {
+    std::vector<SpatialIndex<const WorldObject*>::Entry> entries;
+    for (const WorldObject& object : cell.getObjects()) {
+        SpatialIndex<const WorldObject*>::Entry entry;
+        object.getBounds(entry.min, entry.max);
+        entry.value = &object;
+        entries.push_back(entry);
+    }
+    objectIndex.insertCell(CellKey{cell.getX(), cell.getZ()}, entries);
+}
+
+void Terrain::edit(const TerrainBrush& brush) {
+    PROFILE_ZONE("Terrain::edit");
+    std::vector<TerrainEditRegion> changed;
+    // getHeights reads the edits on other threads
+    std::unique_lock<std::shared_mutex> lock(cellsMutex);
+    edits.apply(brush, changed);
+    lastEdit = std::chrono::steady_clock::now();
+    for (const TerrainEditRegion& region : changed) {
+        auto cell = cells.peek(region.key);
+        if (cell != nullptr) {
+            (*cell)->setHeights(edits.find(region.key), region, seed);
+            indexObjects(**cell);
+        }
+        if (regionStore != nullptr) {
+            unsavedEdits.insert(region.key);
+        }
     }
 }
 
-Terrain::Terrain(int seed) : seed(seed) {
+void Terrain::saveEdits() {
+    PROFILE_ZONE("Terrain::saveEdits");
+    // the store copies the heights and builds the cell on its own thread
+    for (const CellKey& key : unsavedEdits) {
+        regionStore->saveHeights(key.x, key.z, edits.find(key));
+    }
+    unsavedEdits.clear();
+}
 
+static int floorDiv(int a, int b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
 }
 
-#define TERRAIN_HASH(cx, cz) (cx * 32768 + cz)
+bool Terrain::fillApron(CellKey key, float* apron) {
+    const int n = TERRAIN_POINTS_PER_CELL;
+    const int side = TERRAIN_HEIGHTMAP_SIZE;
+    // apron point a, b is lattice point a - 1, b - 1 of the cell, which may lie in a neighbour
+    CellKey lastKey = {0, 0};
+    const TerrainCell* lastCell = nullptr;
+    for (int a = 0; a < side; a++) {
+        int gx = key.x * n + a - 1;
+        int cx = floorDiv(gx, n);
+        for (int b = 0; b < side; b++) {
+            int gz = key.z * n + b - 1;
+            CellKey owner = {cx, floorDiv(gz, n)};
+            if (lastCell == nullptr || !(owner == lastKey)) {
+                auto cell = cells.peek(owner);
+                if (cell == nullptr || (*cell)->getLod() != 0) {
+                    // a coarse cell's lattice is partly interpolated
+                    return false;
+                }
+                lastCell = cell->get();
+                lastKey = owner;
+            }
+            apron[a * side + b] = lastCell->getLatticePoint(gx - owner.x * n, gz - owner.z * n);
+        }
+    }
+    return true;
+}
 
-void Terrain::render(Shader& terrainShader, Shader& objectShader, float x, float z) {
-    int cellX = static_cast<int>(x / TERRAIN_CELL_SIZE);
-    int cellZ = static_cast<int>(z / TERRAIN_CELL_SIZE);
-    for (int cx = cellX - TERRAIN_RENDER_DISTANCE; cx <= cellX + TERRAIN_RENDER_DISTANCE; cx++) {
-        for (int cz = cellZ - TERRAIN_RENDER_DISTANCE; cz <= cellZ + TERRAIN_RENDER_DISTANCE; cz++) {
+void Terrain::requestPrefetch(int cellX, int cellZ, float x, float z, std::vector<CellRequest>& requests) {
+    // Prefetch the window around where the camera will be, as far as the cache margin
+    // allows. Those cells enter at the far edge, so they are generated at its coarse level.
+    glm::vec2 ahead = glm::vec2(cameraVelocity.x, cameraVelocity.z) * (TERRAIN_PREFETCH_SECONDS / TERRAIN_CELL_SIZE);
+    int aheadX = std::max(std::min(static_cast<int>(std::round(ahead.x)), TERRAIN_PREFETCH_CELLS), -TERRAIN_PREFETCH_CELLS);
+    int aheadZ = std::max(std::min(static_cast<int>(std::round(ahead.y)), TERRAIN_PREFETCH_CELLS), -TERRAIN_PREFETCH_CELLS);
+    if (aheadX == 0 && aheadZ == 0) {
+        return;
+    }
+    for (int cx = cellX + aheadX - renderDistance; cx <= cellX + aheadX + renderDistance; cx++) {
+        for (int cz = cellZ + aheadZ - renderDistance; cz <= cellZ + aheadZ + renderDistance; cz++) {
+            if (std::abs(cx - cellX) <= renderDistance && std::abs(cz - cellZ) <= renderDistance) {
+                continue;
+            }
+            if (cells.peek(CellKey{cx, cz}) == nullptr) {
+                requests.push_back(CellRequest{CellKey{cx, cz}, getLodLevel(cx - cellX, cz - cellZ), getRequestDistance(cx, cz, x, z)});
+            }
+        }
+    }
+}
+
+void Terrain::waitForWindow(float x, float z) {
+    PROFILE_ZONE("Terrain::waitForWindow");
+    CellKey cameraCell = terraingen::getCellKey(x, z);
+    while (true) {
+        std::vector<CellRequest> requests;
+        {
+            std::shared_lock<std::shared_mutex> lock(cellsMutex);
+            for (int cx = cameraCell.x - renderDistance; cx <= cameraCell.x + renderDistance; cx++) {
+                for (int cz = cameraCell.z - renderDistance; cz <= cameraCell.z + renderDistance; cz++) {
+                    int lod = getLodLevel(cx - cameraCell.x, cz - cameraCell.z);
+                    auto cell = cells.peek(CellKey{cx, cz});
+                    if (cell == nullptr || (*cell)->getLod() > lod) {
+                        requests.push_back(CellRequest{CellKey{cx, cz}, lod, getRequestDistance(cx, cz, x, z)});
+                    }
+                }
+            }
+            requestPrefetch(cameraCell.x, cameraCell.z, x, z, requests);
+        }
+        if (requests.empty()) {
+            return;
+        }
+        requestCells(requests, true);
+        {
+            // every generator stops once the queue is empty and its cell is in completed
+            std::unique_lock<std::mutex> lock(requestsMutex);
+            generatorsDone.wait(lock, [this]() {
+                return generators == 0;
+            });
+        }
+        {
+            // the workers finish in any order, upload in a fixed one so the cache evicts the same cells every run
+            std::lock_guard<std::mutex> lock(completedMutex);
+            std::sort(completed.begin(), completed.end(), [](const std::unique_ptr<TerrainCell>& a, const std::unique_ptr<TerrainCell>& b) {
+                return a->getX() != b->getX() ? a->getX() < b->getX() : (a->getZ() != b->getZ() ? a->getZ() < b->getZ() : a->getLod() < b->getLod());
+            });
+        }
+        uploadCompleted(std::numeric_limits<float>::infinity());
+    }
+}
+
+void Terrain::render(Shader& terrainShader, Shader& objectShader, float x, float z, const Frustum& frustum) {
+    PROFILE_ZONE("Terrain::render");
+    renderStats = TerrainRenderStats();
+    if (waitForCells) {
+        waitForWindow(x, z);
+    }
+    uploadCompleted(TERRAIN_UPLOAD_BUDGET_MS);
+    // a stroke touches the same cells every frame, save them once it pauses
+    if (!unsavedEdits.empty() && std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - lastEdit).count() >= TERRAIN_EDIT_SAVE_DELAY_MS) {
+        saveEdits();
+    }
+    objectRenderer.clear();
+    terrainShader.use();
+    terrainShader.setFloat("latticeSpacing", 1.0f / TERRAIN_RESOLUTION);
+    terrainShader.setFloat("heightScale", 1.0f / TERRAIN_HEIGHT_STEPS);
+    if (heightmapAtlas != nullptr) {
+        terrainShader.setInt("heightmap", 1);
+        heightmapAtlas->bind(1);
+    }
+    if (vertexArena != nullptr) {
+        terrainShader.setInt("cellOrigins", 1);
+        terrainShader.setInt("slotVertices", vertexArena->getSlotVertices());
+        terrainShader.setFloat("cellSize", TERRAIN_CELL_SIZE);
+    }
+    CellKey cameraCell = terraingen::getCellKey(x, z);
+    int cellX = cameraCell.x;
+    int cellZ = cameraCell.z;
+    // missing and too coarse cells, handed to the workers in one go once the window is walked
+    std::vector<CellRequest> requests;
+    // the window's cells, row by row along z, and the level each is drawn at
+    const int side = 2 * renderDistance + 1;
+    std::vector<TerrainCell*> window(side * side, nullptr);
+    std::vector<int> drawLods(side * side);
+    // looking cells up reorders the cache
+    std::unique_lock<std::shared_mutex> lock(cellsMutex);
+    for (int cx = cellX - renderDistance; cx <= cellX + renderDistance; cx++) {
+        for (int cz = cellZ - renderDistance; cz <= cellZ + renderDistance; cz++) {
+            int index = (cx - cellX + renderDistance) * side + cz - cellZ + renderDistance;
+            int lod = getLodLevel(cx - cellX, cz - cellZ);
+            drawLods[index] = lod;
             // check if this cell is in the cache
-            int hash = TERRAIN_HASH(cx, cz);
-            if (cells.find(hash) == cells.end()) {
-                // need to generate this terrain cell then
-                cells.insert_or_assign(hash, std::make_unique<TerrainCell>(cx, cz, seed));
+            auto cell = cells.get(CellKey{cx, cz});
+            if (cell == nullptr) {
+                // not generated yet, queue it and leave a gap until it is ready
+                requests.push_back(CellRequest{CellKey{cx, cz}, lod, getRequestDistance(cx, cz, x, z)});
+                continue;
+            }
+            window[index] = cell->get();
+            if ((*cell)->getLod() > lod) {
+                // too coarse now that the camera got closer, keep drawing it until the finer one arrives
+                requests.push_back(CellRequest{CellKey{cx, cz}, lod, getRequestDistance(cx, cz, x, z)});
+                drawLods[index] = (*cell)->getLod();
+            }
+        }
+    }
+    // A stitched edge only bridges one level, so coarsen the cells around a too coarse one
+    // until neighbours differ by one level at most. Each pass spreads it one cell further.
+    for (int pass = 1; pass < TERRAIN_LOD_LEVELS; pass++) {
+        for (int i = 0; i < side; i++) {
+            for (int j = 0; j < side; j++) {
+                int& lod = drawLods[i * side + j];
+                if (i > 0) lod = std::max(lod, drawLods[(i - 1) * side + j] - 1);
+                if (i < side - 1) lod = std::max(lod, drawLods[(i + 1) * side + j] - 1);
+                if (j > 0) lod = std::max(lod, drawLods[i * side + j - 1] - 1);
+                if (j < side - 1) lod = std::max(lod, drawLods[i * side + j + 1] - 1);
+            }
+        }
+    }
+    for (int i = 0; i < side; i++) {
+        for (int j = 0; j < side; j++) {
+            TerrainCell* cell = window[i * side + j];
+            if (cell == nullptr) {
+                continue;
             }
-            TerrainCell& tcell = *cells[hash];
-            tcell.render(terrainShader, objectShader);
+            if (!frustum.intersects(cell->getBoundsMin(), cell->getBoundsMax())) {
+                renderStats.cellsCulled++;
+                continue;
+            }
+            // stitch the edges facing neighbours drawn coarser, cells outside the window aren't drawn
+            int lod = drawLods[i * side + j];
+            int mask = 0;
+            if (i > 0 && drawLods[(i - 1) * side + j] > lod) mask |= 1;
+            if (i < side - 1 && drawLods[(i + 1) * side + j] > lod) mask |= 2;
+            if (j > 0 && drawLods[i * side + j - 1] > lod) mask |= 4;
+            if (j < side - 1 && drawLods[i * side + j + 1] > lod) mask |= 8;
+            cell->submit(drawQueue, terrainShader, gridMesh.get(), lodRanges[lod][mask]);
+            cell->collectObjects(objectRenderer, frustum, renderStats);
+            renderStats.cellsDrawn++;
         }
-    }  
+    }
+    requestPrefetch(cellX, cellZ, x, z, requests);
+    lock.unlock();
+    // whatever is still queued from earlier frames but not asked for now is out of range
+    requestCells(requests, true);
+    // cells sharing the shader, atlas texture and (in heightmap mode) grid mesh are drawn back to back
+    drawQueue.execute();
+    if (vertexArena != nullptr) {
+        // every visible cell in one multi-draw
+        terrainShader.use();
+        textures::MINECRAFT->bind();
+        vertexArena->draw(1);
+    }
+    // all visible objects in one instanced draw per model part
+    objectRenderer.render(objectShader);
+    {
+        std::lock_guard<std::mutex> lock(requestsMutex);
+        renderStats.cellsPending = static_cast<int>(queued.size() + inFlight.size());
+    }
 }
 
 float Terrain::getHeight(float x, float z) {
-    int cellX = static_cast<int>(x / TERRAIN_CELL_SIZE);
-    int cellZ = static_cast<int>(z / TERRAIN_CELL_SIZE);
-    // see if this cell exists
-    int hash = TERRAIN_HASH(cellX, cellZ);
-    if (cells.find(hash) == cells.end()) {
-        cells.insert_or_assign(hash, std::make_unique<TerrainCell>(cellX, cellZ, seed));
-    }
-    TerrainCell& cell = *cells[hash];
-    return cell.getHeight(x, z);
+    PROFILE_ZONE("Terrain::getHeight");
+    CellKey key = terraingen::getCellKey(x, z);
+    float height;
+    {
+        // see if this cell exists
+        std::unique_lock<std::shared_mutex> lock(cellsMutex);
+        auto cell = cells.get(key);
+        if (cell != nullptr) {
+            return (*cell)->getHeight(x, z);
+        }
+        // fall back to its edits or the noise
+        const float* edited = edits.find(key);
+        height = edited != nullptr ? terraingen::getHeight(edited, key, x, z) : terraingen::getNoiseHeight(x, z, seed);
+    }
+    // the camera will want this cell soon
+    requestCells({CellRequest{key, 0, 0.0f}}, false);
+    return height;
+}
+
+void Terrain::getHeights(const glm::vec2* points, size_t count, float* heights, glm::vec3* normals) {
+    PROFILE_ZONE("Terrain::getHeights");
+    std::shared_lock<std::shared_mutex> lock(cellsMutex);
+    // queries tend to come in clusters, so remember the last cell looked up
+    CellKey lastKey = {0, 0};
+    TerrainCell* lastCell = nullptr;
+    const float* lastEdited = nullptr;
+    bool looked = false;
+    for (size_t i = 0; i < count; i++) {
+        float x = points[i].x, z = points[i].y;
+        CellKey key = terraingen::getCellKey(x, z);
+        if (!looked || !(key == lastKey)) {
+            auto cell = cells.peek(key);
+            lastCell = cell != nullptr ? cell->get() : nullptr;
+            // edited cells that aren't resident keep their edits, never the noise under them
+            lastEdited = lastCell == nullptr ? edits.find(key) : nullptr;
+            lastKey = key;
+            looked = true;
+        }
+        glm::vec3* normal = normals != nullptr ? &normals[i] : nullptr;
+        if (lastCell != nullptr) {
+            heights[i] = lastCell->getHeight(x, z, normal);
+        } else if (lastEdited != nullptr) {
+            heights[i] = terraingen::getHeight(lastEdited, key, x, z, normal);
+        } else {
+            heights[i] = terraingen::getNoiseHeight(x, z, seed, normal);
+        }
+    }
 }
\ No newline at end of file
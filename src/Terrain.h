@@ -3,42 +3,264 @@
 #include "Shader.h"
 #include "Mesh.h"
 #include "WorldObject.h"
+#include "WorkerPool.h"
+#include "LRUCache.h"
+#include "HeightmapAtlas.h"
+#include "Frustum.h"
+#include "TerrainGenerator.h"
+#include "RegionStore.h"
+#include "InstancedRenderer.h"
+#include "DrawQueue.h"
+#include "SpatialIndex.h"
+#include "TerrainEdits.h"
+#include "VertexArena.h"
 
+#include <chrono>
+#include <condition_variable>
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
 
-#define TERRAIN_RESOLUTION 2 // Number of lattice points in 1 unit along an axis.
-#define TERRAIN_CELL_SIZE 8
-#define TERRAIN_POINTS_PER_CELL TERRAIN_RESOLUTION * TERRAIN_CELL_SIZE
-#define TERRAIN_RENDER_DISTANCE 8
-#define TERRAIN_CACHE_CAPACITY 25
+#define TERRAIN_RENDER_DISTANCE 8 // Default radius of the rendered square of cells, see Terrain::setRenderDistance.
+#define TERRAIN_CACHE_CAPACITY 512 // Default number of resident cells, never less than the render window and its prefetch margin.
+#define TERRAIN_UPLOAD_BUDGET_MS 2.0f // Main thread time spent uploading finished cells per frame.
+#define TERRAIN_LOD_LEVELS 4 // Level n keeps every 2^n-th lattice point along each axis.
+#define TERRAIN_LOD_RADIUS 4 // Cells closer than this use level 0, every further level doubles the distance.
+#define TERRAIN_EDIT_SAVE_DELAY_MS 500.0f // Edited cells are saved once the terrain went this long without a stroke.
+#define TERRAIN_PREFETCH_SECONDS 2.0f // Cells the camera's motion reaches within this are generated before they come into range.
+#define TERRAIN_PREFETCH_CELLS 2 // Furthest the prefetched window runs ahead of the render window, in cells.
+#define TERRAIN_VIEW_PRIORITY 0.5f // Share of its distance taken off a cell's priority when it lies straight ahead of the view.
+#define TERRAIN_MOTION_PRIORITY 0.5f // Same for cells straight along the camera's motion, at TERRAIN_MOTION_FULL_SPEED or above.
+#define TERRAIN_MOTION_FULL_SPEED 10.0f // Camera speed, in units per second, at which motion counts fully.
+
+enum class TerrainRenderMode {
+    // every cell uploads its packed vertex grid into a slot of a shared vertex arena and
+    // all cells are drawn with one multi-draw (terrain_vs.glsl)
+    MESH,
+    // every cell uploads only its heights into a shared atlas and one grid mesh is
+    // displaced in the vertex shader (terrain_heightmap_vs.glsl)
+    HEIGHTMAP
+};
+
+// what the last Terrain::render call drew and skipped
+struct TerrainRenderStats {
+    int cellsDrawn = 0;
+    int cellsCulled = 0;
+    int objectsDrawn = 0;
+    int objectsCulled = 0;
+    // cells that arrived from the workers and were uploaded
+    int cellsUploaded = 0;
+    // cells queued or being generated once the call returned
+    int cellsPending = 0;
+};
 
 class TerrainCell {
 private:
-    int x, z;
-    float latticePoints[TERRAIN_POINTS_PER_CELL + 1][TERRAIN_POINTS_PER_CELL + 1];
-    std::unique_ptr<Mesh> mesh;
+    // Generated lattice and vertices. The vertices are released once uploaded into the arena,
+    // the heightmap is kept while the cell lives in a heightmap atlas so it can be uploaded
+    // again if the atlas moves.
+    TerrainCellData data;
+    VertexArena* arena = nullptr;
+    int arenaSlot = -1;
+    HeightmapAtlas* atlas = nullptr;
+    int atlasSlot = -1;
+    // world space box around the lattice and the objects on it
+    glm::vec3 boundsMin, boundsMax;
 
     std::vector<WorldObject> objects;
+
+    // creates the world objects from the placements and fits the bounds around them
+    void createObjects();
 public:
-    // calling the constructor will generate the mesh for this terrain cell
-    TerrainCell(int x, int z, int seed);
+    // Calling the constructor generates the lattice and vertex data for this terrain cell
+    // (see terraingen::generateCell) and creates its world objects. It makes no GL calls
+    // so it is safe to run on a worker thread.
+    TerrainCell(int x, int z, int seed, int lod = 0);
+    // wraps data generated earlier or loaded from a RegionStore
+    TerrainCell(TerrainCellData data);
+    // gives back the vertex arena or heightmap atlas slot, if any
+    ~TerrainCell();
+
+    TerrainCell(const TerrainCell&) = delete;
+    TerrainCell& operator=(const TerrainCell&) = delete;
+
+    // Uploads the generated vertices into a slot of the arena, must be called on the render
+    // thread. The arena must outlive the cell.
+    void upload(VertexArena& arena);
+    // Uploads the heights into a slot of the atlas instead of the vertices. The atlas must outlive the cell.
+    void upload(HeightmapAtlas& atlas);
+    // re-uploads the heights after the atlas was reallocated
+    void reuploadHeightmap();
+    bool isUploaded() const;
+    // Takes the edited heights of the cell's apron (see TerrainEdits) where region changed,
+    // places the objects again and rebuilds the vertices whose height or normal depends on
+    // the region. An uploaded cell only uploads those vertices, or heightmap texels. A
+    // coarse cell becomes full detail and rebuilds everything.
+    void setHeights(const float* apron, const TerrainEditRegion& region, int seed);
 
-    float getHeight(float x, float z) const;
-    Mesh& getMesh();
-    void render(Shader& terrainShader, Shader& objectShader) const;
+    int getX() const;
+    int getZ() const;
+    int getLod() const;
+    // see terraingen::getHeight
+    float getHeight(float x, float z, glm::vec3* normal = nullptr) const;
+    float getLatticePoint(int i, int j) const;
+    const glm::vec3& getBoundsMin() const;
+    const glm::vec3& getBoundsMax() const;
+    // Queues the draw of the terrain, on the arena for cells uploaded into one and on the
+    // draw queue otherwise. Grid is the shared mesh drawn for cells uploaded into a heightmap
+    // atlas. Range selects the triangles of the level of detail and edge stitching.
+    void submit(DrawQueue& queue, const Shader& terrainShader, const Mesh* grid, IndexRange range) const;
+    const std::vector<WorldObject>& getObjects() const;
+    // Adds the objects inside the frustum to the renderer, the rest are counted in stats.
+    void collectObjects(InstancedRenderer& renderer, const Frustum& frustum, TerrainRenderStats& stats) const;
 }; 
 
 class Terrain {
 private:
-    // should implemented as an LRU
-    std::unordered_map<int, std::unique_ptr<TerrainCell>> cells;
+    // Shared GPU resources, declared before the cells so they outlive them.
+    // triangle lists over a cell's vertex grid for every level of detail, shared by every cell
+    std::unique_ptr<IndexBuffer> cellIndices;
+    // [lod][stitch mask] ranges of cellIndices, see buildLodIndices
+    IndexRange lodRanges[TERRAIN_LOD_LEVELS][16];
+    // MESH mode only: the vertices of every resident cell, one slot each
+    std::unique_ptr<VertexArena> vertexArena;
+    // HEIGHTMAP mode only: per cell heights and the grid mesh displaced by them
+    std::unique_ptr<HeightmapAtlas> heightmapAtlas;
+    std::unique_ptr<Mesh> gridMesh;
+    // per model instance buffers of the visible world objects
+    InstancedRenderer objectRenderer;
+    // terrain draws of the current frame, sorted by state before drawing
+    DrawQueue drawQueue;
+
+    // resident cells, evicting a cell frees its arena or atlas slot
+    LRUCache<CellKey, std::unique_ptr<TerrainCell>, CellKeyHash> cells;
+    // the world objects of the resident cells, kept in step with cells
+    SpatialIndex<const WorldObject*> objectIndex;
+    // Guards cells, their heights and objects, and objectIndex against other threads. The
+    // render thread holds it exclusively while it changes them or reorders the cache.
+    mutable std::shared_mutex cellsMutex;
     int seed;
+    // optional, cells are loaded from and saved to it on the workers
+    RegionStore* regionStore;
+    // heights of every cell edited since the start, they replace what cells are generated
+    // or loaded with so edits survive eviction
+    TerrainEdits edits;
+    // edited cells not saved to the region store yet
+    std::unordered_set<CellKey, CellKeyHash> unsavedEdits;
+    std::chrono::steady_clock::time_point lastEdit;
+    TerrainRenderMode renderMode;
+    int renderDistance;
+    TerrainRenderStats renderStats;
+
+    struct CellRequest {
+        CellKey key;
+        int lod;
+        // distance from the camera in cells, discounted for cells ahead, the nearest is generated first
+        float distance;
+    };
+    // Cells waiting for a worker, rebuilt every render so the order follows the camera
+    // and cells that went out of range are dropped before they are generated.
+    std::unordered_map<CellKey, CellRequest, CellKeyHash> queued;
+    // cells taken by a worker and not uploaded yet, with the finest level requested
+    std::unordered_map<CellKey, int, CellKeyHash> inFlight;
+    // jobs on the workers taking cells off queued
+    size_t generators = 0;
+    std::mutex requestsMutex;
+    // notified when the last generator stops
+    std::condition_variable generatorsDone;
+    // see setWaitForCells
+    bool waitForCells = false;
+    // where the camera is heading, see setCameraMotion
+    glm::vec3 cameraVelocity = glm::vec3(0.0f);
+    glm::vec3 cameraForward = glm::vec3(0.0f, 0.0f, -1.0f);
+    // cells the workers have finished, waiting to be uploaded by the render thread
+    std::vector<std::unique_ptr<TerrainCell>> completed;
+    std::mutex completedMutex;
+
+    // declared last so the workers are joined before the state they write to is destroyed
+    WorkerPool workers;
+
+    // Queues the requests, skipping cells already taken by a worker at their level or finer,
+    // and starts enough generators to work through them. With cancelOthers the requests
+    // replace everything still queued.
+    void requestCells(const std::vector<CellRequest>& requests, bool cancelOthers);
+    // worker job: generates the nearest queued cell until none are left
+    void generateQueued();
+    // CellRequest::distance of a cell for a camera at x, z
+    float getRequestDistance(int cx, int cz, float x, float z) const;
+    // level of detail for a cell at the given offset (in cells) from the camera's cell
+    static int getLodLevel(int dx, int dz);
+    // Appends requests for the missing cells of the window around where the camera will be,
+    // see setCameraMotion. cellsMutex must be held.
+    void requestPrefetch(int cellX, int cellZ, float x, float z, std::vector<CellRequest>& requests);
+    // generates and uploads the missing and too coarse cells of the window and prefetch margin
+    void waitForWindow(float x, float z);
+    void uploadCompleted(float budgetMs);
+    // puts the world objects of a resident cell into objectIndex, replacing its old ones
+    void indexObjects(const TerrainCell& cell);
+    // hands the cells edited since the last call to the region store, which builds and writes them
+    void saveEdits();
+    // Fills the apron heights of a cell from the resident full detail cells holding its
+    // points, false if one of them isn't resident. cellsMutex must be held.
+    bool fillApron(CellKey key, float* apron);
 public:
-    Terrain(int seed);
+    // The render mode decides which vertex shader the terrain shader must be built
+    // from, see TerrainRenderMode. If a region store is given, saved cells are loaded
+    // from it instead of generated and newly generated cells are saved to it. The store
+    // must be created for the same seed and outlive the terrain.
+    Terrain(int seed, TerrainRenderMode renderMode = TerrainRenderMode::MESH, RegionStore* regionStore = nullptr);
+    // drops the queued cells and saves the edits not saved yet
+    ~Terrain();
+
+    // Sets how many generated cells are kept resident. The capacity never drops below
+    // the number of cells in the render window and the prefetch margin around it so
+    // visible cells are not evicted.
+    void setCacheCapacity(size_t capacity);
+    size_t getCacheCapacity() const;
+    size_t getCacheSize() const;
+    const CacheStats& getCacheStats() const;
+    TerrainRenderMode getRenderMode() const;
+
+    // Sets the radius, in cells, of the square of cells rendered around the camera.
+    // Also grows the cache capacity to cover the new render window and prefetch margin.
+    void setRenderDistance(int distance);
+    int getRenderDistance() const;
 
-    // Queries the terrain cells to find the precise height of the terrain at the given x,z coordinate
+    // Queries the terrain cells to find the precise height of the terrain at the given x,z coordinate.
+    // If the cell is not generated yet the height comes from its edits, or the noise if it was
+    // never edited, instead of blocking. Render thread only.
     float getHeight(float x, float z);
-    // Given some x, z we will render the surrounding cells in their proper place
-    void render(Shader& terrainShader, Shader& objectShader, float x, float z);
+    // Heights, and normals if given, at each of count (x, z) points. Generated cells are
+    // sampled where resident, edits or the noise elsewhere; unlike getHeight this
+    // never queues cell generation, so it is cheap to call for far away points. Thread
+    // safe, must not be called while holding lockShared.
+    void getHeights(const glm::vec2* points, size_t count, float* heights, glm::vec3* normals = nullptr);
+    // Applies a brush stroke to the terrain. Resident cells under it are updated in place,
+    // the edit is kept for the rest. With a region store the edited cells are saved by a
+    // render once no stroke came for TERRAIN_EDIT_SAVE_DELAY_MS.
+    void edit(const TerrainBrush& brush);
+    // Tells the terrain where the camera is heading, in world units per second and along
+    // its view. Missing cells ahead of it are generated first and those it is about to reach
+    // are prefetched before they come into range. Render thread only.
+    void setCameraMotion(const glm::vec3& velocity, const glm::vec3& forward);
+    // For benchmarks. While set, render blocks until every cell of the render window and
+    // the prefetch margin is generated and uploads them all without a time budget, so the
+    // same camera path draws the same frames on every run. Off by default.
+    void setWaitForCells(bool wait);
+    // Given some x, z we will render the surrounding cells in their proper place.
+    // Cells and objects outside the frustum are not drawn. The object shader must be
+    // built from instanced_vs.glsl, all world objects are drawn instanced.
+    void render(Shader& terrainShader, Shader& objectShader, float x, float z, const Frustum& frustum);
+    // counters from the last render call
+    const TerrainRenderStats& getRenderStats() const;
+    // Spatial index over the world objects of every resident cell, for proximity and
+    // collision queries. Entries are the objects' bounding boxes and point at the objects,
+    // which stay valid until their cell is evicted. Other threads than the render thread
+    // must hold lockShared while they use it.
+    const SpatialIndex<const WorldObject*>& getObjectIndex() const;
+    // keeps the render thread from changing the cells and objects while it is held
+    std::shared_lock<std::shared_mutex> lockShared() const;
 };
@@ -0,0 +1,139 @@
+#include "TerrainEdits.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "Profiler.h"
+
+static int floorDiv(int a, int b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+static int ceilDiv(int a, int b) {
+    return -floorDiv(-a, b);
+}
+
+TerrainEdits::TerrainEdits(int seed, RegionStore* regionStore) : seed(seed), regionStore(regionStore) {}
+
+void TerrainEdits::setHeightSource(TerrainHeightSource source) {
+    heightSource = std::move(source);
+}
+
+std::vector<float>& TerrainEdits::getHeights(CellKey key) {
+    auto it = cells.find(key);
+    if (it != cells.end()) {
+        return it->second;
+    }
+    const int apronSide = TERRAIN_HEIGHTMAP_SIZE;
+    std::vector<float>& heights = cells[key];
+    heights.resize(apronSide * apronSide);
+    if (heightSource && heightSource(key, heights.data())) {
+        return heights;
+    }
+    // a saved cell may carry edits from an earlier run
+    TerrainCellData saved;
+    if (regionStore != nullptr && regionStore->load(key.x, key.z, saved) && saved.heightmap.size() == heights.size()) {
+        // the heightmap is quantized, the lattice points are exact
+        for (size_t i = 0; i < heights.size(); i++) {
+            heights[i] = static_cast<float>(saved.heightmap[i]) / TERRAIN_HEIGHT_STEPS;
+        }
+        for (int i = 0; i <= TERRAIN_POINTS_PER_CELL; i++) {
+            for (int j = 0; j <= TERRAIN_POINTS_PER_CELL; j++) {
+                heights[(i + 1) * apronSide + j + 1] = saved.latticePoints[i][j];
+            }
+        }
+    } else {
+        terraingen::generateLattice(heights.data(), key.x, key.z, seed, 0);
+    }
+    return heights;
+}
+
+void TerrainEdits::apply(const TerrainBrush& brush, std::vector<TerrainEditRegion>& changed) {
+    PROFILE_ZONE("TerrainEdits::apply");
+    const int n = TERRAIN_POINTS_PER_CELL;
+    const int apronSide = TERRAIN_HEIGHTMAP_SIZE;
+    // lattice points under the brush
+    int gx0 = static_cast<int>(std::ceil((brush.x - brush.radius) * TERRAIN_RESOLUTION));
+    int gx1 = static_cast<int>(std::floor((brush.x + brush.radius) * TERRAIN_RESOLUTION));
+    int gz0 = static_cast<int>(std::ceil((brush.z - brush.radius) * TERRAIN_RESOLUTION));
+    int gz1 = static_cast<int>(std::floor((brush.z + brush.radius) * TERRAIN_RESOLUTION));
+    if (gx0 > gx1 || gz0 > gz1) {
+        return;
+    }
+
+    // New heights first, each read from the cell owning the point. Points outside the
+    // disc are marked NaN and left alone.
+    const int width = gz1 - gz0 + 1;
+    std::vector<float> updated((gx1 - gx0 + 1) * width);
+    for (int gx = gx0; gx <= gx1; gx++) {
+        int cx = floorDiv(gx, n);
+        for (int gz = gz0; gz <= gz1; gz++) {
+            float dx = static_cast<float>(gx) / TERRAIN_RESOLUTION - brush.x;
+            float dz = static_cast<float>(gz) / TERRAIN_RESOLUTION - brush.z;
+            float falloff = 1 - (dx * dx + dz * dz) / (brush.radius * brush.radius);
+            float& height = updated[(gx - gx0) * width + gz - gz0];
+            if (falloff <= 0) {
+                height = NAN;
+                continue;
+            }
+            falloff *= falloff;
+            int cz = floorDiv(gz, n);
+            height = getHeights(CellKey{cx, cz})[(gx - cx * n + 1) * apronSide + gz - cz * n + 1];
+            switch (brush.mode) {
+                case TerrainBrushMode::RAISE:
+                    height += brush.strength * falloff;
+                    break;
+                case TerrainBrushMode::LOWER:
+                    height -= brush.strength * falloff;
+                    break;
+                case TerrainBrushMode::FLATTEN:
+                    height += (brush.target - height) * std::min(brush.strength * falloff, 1.0f);
+                    break;
+            }
+        }
+    }
+
+    // then copied into every cell whose apron holds them, cell c holds lattice points
+    // c * n - 1 to c * n + n + 1 along each axis
+    for (int cx = ceilDiv(gx0 - n - 1, n); cx <= floorDiv(gx1 + 1, n); cx++) {
+        for (int cz = ceilDiv(gz0 - n - 1, n); cz <= floorDiv(gz1 + 1, n); cz++) {
+            int i0 = std::max(gx0 - cx * n + 1, 0), i1 = std::min(gx1 - cx * n + 1, apronSide - 1);
+            int j0 = std::max(gz0 - cz * n + 1, 0), j1 = std::min(gz1 - cz * n + 1, apronSide - 1);
+            // shrink to the points that changed, the disc may miss the cell's corner of the square
+            TerrainEditRegion region = {CellKey{cx, cz}, apronSide, apronSide, -1, -1};
+            for (int i = i0; i <= i1; i++) {
+                for (int j = j0; j <= j1; j++) {
+                    if (!std::isnan(updated[(i - 1 + cx * n - gx0) * width + j - 1 + cz * n - gz0])) {
+                        region.i0 = std::min(region.i0, i);
+                        region.i1 = std::max(region.i1, i);
+                        region.j0 = std::min(region.j0, j);
+                        region.j1 = std::max(region.j1, j);
+                    }
+                }
+            }
+            if (region.i1 < 0) {
+                continue;
+            }
+            std::vector<float>& heights = getHeights(region.key);
+            for (int i = region.i0; i <= region.i1; i++) {
+                for (int j = region.j0; j <= region.j1; j++) {
+                    float height = updated[(i - 1 + cx * n - gx0) * width + j - 1 + cz * n - gz0];
+                    if (!std::isnan(height)) {
+                        heights[i * apronSide + j] = height;
+                    }
+                }
+            }
+            changed.push_back(region);
+        }
+    }
+}
+
+const float* TerrainEdits::find(CellKey key) const {
+    auto it = cells.find(key);
+    return it != cells.end() ? it->second.data() : nullptr;
+}
+
+size_t TerrainEdits::size() const {
+    return cells.size();
+}
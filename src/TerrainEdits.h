@@ -0,0 +1,70 @@
+#pragma once
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "TerrainGenerator.h"
+#include "RegionStore.h"
+
+enum class TerrainBrushMode {
+    RAISE,
+    LOWER,
+    // pulls heights towards the brush's target height
+    FLATTEN
+};
+
+// A brush stroke over a disc of the terrain. The effect fades from full strength at the
+// center to nothing at the radius.
+struct TerrainBrush {
+    TerrainBrushMode mode;
+    // center in world x, z
+    float x, z;
+    float radius;
+    // RAISE and LOWER: height change at the center. FLATTEN: part of the way to the
+    // target covered at the center, in [0, 1].
+    float strength;
+    // FLATTEN only
+    float target = 0;
+};
+
+// Fills the apron heights of a cell, laid out like generateLattice writes them, from
+// heights already in memory. Returns false if it doesn't have them all.
+using TerrainHeightSource = std::function<bool(CellKey key, float* apron)>;
+
+// lattice points of a cell changed by an edit, inclusive ranges in apron coordinates
+struct TerrainEditRegion {
+    CellKey key;
+    int i0, j0, i1, j1;
+};
+
+// Heights of the terrain cells that have been edited, the source of truth for those cells
+// from then on. A cell's entry holds the heights of its whole apron, so lattice points on
+// a cell border and in the aprons around it exist in up to four entries; an edit computes
+// every point once and writes it to all of them so neighbouring cells always agree. No GL
+// calls, applying the changes to the drawn cells is left to the caller (see Terrain::edit).
+// Not thread safe.
+class TerrainEdits {
+private:
+    int seed;
+    // optional, where cells edited before a restart are read back from
+    RegionStore* regionStore;
+    // optional, asked before the region store and the noise
+    TerrainHeightSource heightSource;
+    // TERRAIN_HEIGHTMAP_SIZE squared heights per edited cell, row major like generateLattice
+    std::unordered_map<CellKey, std::vector<float>, CellKeyHash> cells;
+
+    // the heights of a cell, starting from the saved or generated ones if it wasn't edited yet
+    std::vector<float>& getHeights(CellKey key);
+public:
+    TerrainEdits(int seed, RegionStore* regionStore = nullptr);
+
+    // where a cell's heights come from when it is edited for the first time, if it has them
+    void setHeightSource(TerrainHeightSource source);
+
+    // Applies the brush and appends the changed part of every cell it touched to changed.
+    void apply(const TerrainBrush& brush, std::vector<TerrainEditRegion>& changed);
+    // apron heights of an edited cell, nullptr if it was never edited
+    const float* find(CellKey key) const;
+    size_t size() const;
+};
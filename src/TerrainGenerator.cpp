@@ -0,0 +1,291 @@
+#include "TerrainGenerator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "Math.h"
+#include "Profiler.h"
+
+// random streams of a cell, one per kind of decision
+enum RandomStreamID {
+    TREE_STREAM = 1
+};
+
+enum TextureID {
+    GRASS=0,
+    STONE=1,
+    DIRT=2,
+    COBBLESTONE=24,
+    SAND=26,
+    GRAVEL=27
+};
+
+// noise space the terrain is sampled from: world units are divided by NOISE_SCALE and offset
+static const float NOISE_SCALE = 43.45231f;
+static const float NOISE_ORIGIN_X = 0.4837f;
+static const float NOISE_ORIGIN_Z = 0.9482f;
+// distance between full detail lattice points in noise space, the finest detail the noise needs
+static const float LATTICE_NOISE_SPACING = 1.0f / (TERRAIN_RESOLUTION * NOISE_SCALE);
+
+static std::atomic<const noise::NoisePreset*> noisePreset{nullptr};
+static std::atomic<NoiseBackend> noiseBackend{NoiseBackend::HASH};
+
+void terraingen::setNoisePreset(const noise::NoisePreset& preset) {
+    noisePreset = &preset;
+}
+
+const noise::NoisePreset& terraingen::getNoisePreset() {
+    const noise::NoisePreset* preset = noisePreset;
+    return preset != nullptr ? *preset : noise::getDefaultPreset();
+}
+
+void terraingen::setNoiseBackend(NoiseBackend backend) {
+    noiseBackend = backend;
+}
+
+NoiseBackend terraingen::getNoiseBackend() {
+    return noiseBackend;
+}
+
+float terraingen::getLatticeHeight(int gx, int gz, int seed) {
+    return getNoisePreset().sample(
+        NOISE_ORIGIN_X + (static_cast<float>(gx) / TERRAIN_RESOLUTION) / NOISE_SCALE,
+        NOISE_ORIGIN_Z + (static_cast<float>(gz) / TERRAIN_RESOLUTION) / NOISE_SCALE,
+        noise::NoiseSource(seed, getNoiseBackend()), LATTICE_NOISE_SPACING
+    );
+}
+
+static float getTexture(float height) {
+    if (height < 0) return SAND;
+    else if (height < 2) return STONE;
+    else if (height < 4) return DIRT;
+    else return GRASS;
+}
+
+// Maps a unit normal onto the octahedron folded around the y axis and stores the
+// x/z coordinates as snorm8, decoded by decodeNormal in terrain_vs.glsl.
+static void encodeNormal(glm::vec3 n, signed char out[2]) {
+    n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    float u = n.x, v = n.z;
+    if (n.y < 0) {
+        u = (1.0f - std::abs(n.z)) * (n.x < 0 ? -1.0f : 1.0f);
+        v = (1.0f - std::abs(n.x)) * (n.z < 0 ? -1.0f : 1.0f);
+    }
+    out[0] = static_cast<signed char>(std::lround(math::clampf(u, -1, 1) * 127));
+    out[1] = static_cast<signed char>(std::lround(math::clampf(v, -1, 1) * 127));
+}
+
+short terraingen::quantizeHeight(float height) {
+    return static_cast<short>(std::lround(math::clampf(height * TERRAIN_HEIGHT_STEPS, -32768, 32767)));
+}
+
+void terraingen::generateLattice(float* apron, int x, int z, int seed, int lod) {
+    // Sample the noise for the lattice plus a one point apron around it in one batch,
+    // the apron lets normals on the cell border match the neighbouring cells.
+    // Coarser levels only sample every step-th point (and a step wide apron).
+    const int apronSide = TERRAIN_HEIGHTMAP_SIZE;
+    const int step = 1 << lod;
+    const int coarseSide = TERRAIN_POINTS_PER_CELL / step + 3;
+    // Coarse levels still leave out the same octaves as level 0 so the points they share
+    // with finer neighbours have the same height and the stitched edges meet.
+    const float spacing = LATTICE_NOISE_SPACING;
+    std::vector<float> coarse(coarseSide * coarseSide);
+    getNoisePreset().sampleGrid(
+        coarse.data(), coarseSide,
+        NOISE_ORIGIN_X + (x * TERRAIN_CELL_SIZE) / NOISE_SCALE - step * spacing,
+        NOISE_ORIGIN_Z + (z * TERRAIN_CELL_SIZE) / NOISE_SCALE - step * spacing,
+        step * spacing, step * spacing,
+        coarseSide, coarseSide,
+        noise::NoiseSource(seed, getNoiseBackend()), spacing
+    );
+    if (step == 1) {
+        std::copy(coarse.begin(), coarse.end(), apron);
+        return;
+    }
+    // fill in the full resolution apron, points between samples are interpolated
+    for (int i = 0; i < apronSide; i++) {
+        float ci = static_cast<float>(i - 1 + step) / step;
+        int i0 = std::min(static_cast<int>(ci), coarseSide - 2);
+        for (int j = 0; j < apronSide; j++) {
+            float cj = static_cast<float>(j - 1 + step) / step;
+            int j0 = std::min(static_cast<int>(cj), coarseSide - 2);
+            float h0 = math::interpolate(coarse[i0 * coarseSide + j0], coarse[i0 * coarseSide + j0 + 1], cj - j0);
+            float h1 = math::interpolate(coarse[(i0 + 1) * coarseSide + j0], coarse[(i0 + 1) * coarseSide + j0 + 1], cj - j0);
+            apron[i * apronSide + j] = math::interpolate(h0, h1, ci - i0);
+        }
+    }
+}
+
+// Scatters trees over a jittered grid: the cell is split into TERRAIN_TREE_GRID squared
+// slots and each slot holds a tree with a chance of TERRAIN_TREE_DENSITY, somewhere away
+// from the slot's edges. Every slot draws from its own counters of the cell's stream, so
+// the placements only depend on the seed and the cell.
+static void placeTrees(TerrainCellData& cell, int seed) {
+    math::RandomStream random(seed, cell.x, cell.z, TREE_STREAM);
+    const float slot = static_cast<float>(TERRAIN_CELL_SIZE) / TERRAIN_TREE_GRID;
+    for (int i = 0; i < TERRAIN_TREE_GRID; i++) {
+        for (int j = 0; j < TERRAIN_TREE_GRID; j++) {
+            // three numbers per slot: occupied, x and z
+            unsigned int n = (i * TERRAIN_TREE_GRID + j) * 3;
+            if (random.getFloat(n) >= TERRAIN_TREE_DENSITY) {
+                continue;
+            }
+            float wx = cell.x * TERRAIN_CELL_SIZE + (i + random.getFloat(n + 1, TERRAIN_TREE_MARGIN, 1 - TERRAIN_TREE_MARGIN)) * slot;
+            float wz = cell.z * TERRAIN_CELL_SIZE + (j + random.getFloat(n + 2, TERRAIN_TREE_MARGIN, 1 - TERRAIN_TREE_MARGIN)) * slot;
+            float h = terraingen::getHeight(cell, wx, wz);
+            if (h < 1.0f) {
+                continue;
+            }
+            cell.objects.push_back(ObjectPlacement{ObjectType::TREE, glm::vec3(wx, h, wz), glm::vec3(1, 1, 1)});
+        }
+    }
+}
+
+TerrainVertex terraingen::buildVertex(const float* apron, int i, int j) {
+    // smooth normals from central differences
+    const int apronSide = TERRAIN_HEIGHTMAP_SIZE;
+    const float pointSpacing = 1.0f / static_cast<float>(TERRAIN_RESOLUTION);
+    const float* center = apron + (i + 1) * apronSide + j + 1;
+    glm::vec3 normal = glm::normalize(glm::vec3(
+        center[-apronSide] - center[apronSide],
+        2 * pointSpacing,
+        center[-1] - center[1]
+    ));
+    TerrainVertex vertex;
+    vertex.i = static_cast<unsigned char>(i);
+    vertex.j = static_cast<unsigned char>(j);
+    encodeNormal(normal, vertex.normal);
+    vertex.height = quantizeHeight(*center);
+    vertex.texture = static_cast<unsigned char>(getTexture(*center));
+    vertex.unused = 0;
+    return vertex;
+}
+
+void terraingen::setHeights(TerrainCellData& cell, const float* apron) {
+    const int side = TERRAIN_POINTS_PER_CELL + 1;
+    const int apronSide = TERRAIN_HEIGHTMAP_SIZE;
+    for (size_t i = 0; i < cell.heightmap.size(); i++) {
+        cell.heightmap[i] = quantizeHeight(apron[i]);
+    }
+    float minHeight = apron[apronSide + 1], maxHeight = minHeight;
+    for (int i = 0; i < side; i++) {
+        for (int j = 0; j < side; j++) {
+            float height = apron[(i + 1) * apronSide + j + 1];
+            cell.latticePoints[i][j] = height;
+            minHeight = std::min(minHeight, height);
+            maxHeight = std::max(maxHeight, height);
+        }
+    }
+    cell.boundsMin = glm::vec3(cell.x * TERRAIN_CELL_SIZE, minHeight, cell.z * TERRAIN_CELL_SIZE);
+    cell.boundsMax = glm::vec3((cell.x + 1) * TERRAIN_CELL_SIZE, maxHeight, (cell.z + 1) * TERRAIN_CELL_SIZE);
+}
+
+void terraingen::placeObjects(TerrainCellData& cell, int seed) {
+    cell.objects.clear();
+    placeTrees(cell, seed);
+}
+
+TerrainCellData terraingen::buildCell(int x, int z, int seed, const float* apron, int lod) {
+    TerrainCellData cell;
+    cell.x = x;
+    cell.z = z;
+    cell.lod = lod;
+    cell.heightmap.resize(TERRAIN_HEIGHTMAP_SIZE * TERRAIN_HEIGHTMAP_SIZE);
+    setHeights(cell, apron);
+
+    // one vertex per lattice point, row major
+    const int side = TERRAIN_POINTS_PER_CELL + 1;
+    cell.vertices.resize(side * side);
+    for (int i = 0; i < side; i++) {
+        for (int j = 0; j < side; j++) {
+            cell.vertices[i * side + j] = buildVertex(apron, i, j);
+        }
+    }
+
+    placeTrees(cell, seed);
+    return cell;
+}
+
+TerrainCellData terraingen::generateCell(int x, int z, int seed, int lod) {
+    PROFILE_ZONE("terraingen::generateCell");
+    PROFILE_COUNTER(ProfileCounter::CELLS_GENERATED, 1);
+    const int apronSide = TERRAIN_HEIGHTMAP_SIZE;
+    float apron[apronSide * apronSide];
+    generateLattice(apron, x, z, seed, lod);
+    return buildCell(x, z, seed, apron, lod);
+}
+
+// Interpolates the heights at the corners of a lattice square over its two triangles,
+// split along the (0, 0) - (1, 1) diagonal like the cell mesh. fx and fz are the position
+// within the square along x and z in [0, 1].
+static float interpolateSquare(float h00, float h01, float h10, float h11, float fx, float fz, glm::vec3* normal) {
+    float dx, dz;
+    if (fx >= fz) {
+        // triangle (0, 0), (1, 0), (1, 1)
+        dx = h10 - h00;
+        dz = h11 - h10;
+    } else {
+        // triangle (0, 0), (0, 1), (1, 1)
+        dx = h11 - h01;
+        dz = h01 - h00;
+    }
+    if (normal != nullptr) {
+        const float spacing = 1.0f / TERRAIN_RESOLUTION;
+        *normal = glm::normalize(glm::vec3(-dx, spacing, -dz));
+    }
+    return h00 + fx * dx + fz * dz;
+}
+
+CellKey terraingen::getCellKey(float x, float z) {
+    return CellKey{
+        static_cast<int>(std::floor(x / TERRAIN_CELL_SIZE)),
+        static_cast<int>(std::floor(z / TERRAIN_CELL_SIZE))
+    };
+}
+
+float terraingen::getHeight(const TerrainCellData& cell, float x, float z, glm::vec3* normal) {
+    float px = x - static_cast<float>(cell.x * TERRAIN_CELL_SIZE);
+    float pz = z - static_cast<float>(cell.z * TERRAIN_CELL_SIZE);
+    if (px < 0 || px > TERRAIN_CELL_SIZE || pz < 0 || pz > TERRAIN_CELL_SIZE) {
+        throw std::runtime_error("terraingen::getHeight: Coordinate out of range of this terrain cell (querying: "
+                                     + std::to_string(x) + ", " + std::to_string(z) + " in terrain cell: " + std::to_string(cell.x) + ", " + std::to_string(cell.z) + ")");
+    }
+    // the far edge belongs to the last square
+    float gx = px * TERRAIN_RESOLUTION;
+    float gz = pz * TERRAIN_RESOLUTION;
+    int x0 = std::min(static_cast<int>(gx), TERRAIN_POINTS_PER_CELL - 1);
+    int z0 = std::min(static_cast<int>(gz), TERRAIN_POINTS_PER_CELL - 1);
+    return interpolateSquare(
+        cell.latticePoints[x0][z0], cell.latticePoints[x0][z0 + 1],
+        cell.latticePoints[x0 + 1][z0], cell.latticePoints[x0 + 1][z0 + 1],
+        gx - x0, gz - z0, normal
+    );
+}
+
+float terraingen::getHeight(const float* apron, CellKey key, float x, float z, glm::vec3* normal) {
+    const int n = TERRAIN_POINTS_PER_CELL;
+    float gx = x * TERRAIN_RESOLUTION - static_cast<float>(key.x * n);
+    float gz = z * TERRAIN_RESOLUTION - static_cast<float>(key.z * n);
+    // the far edge belongs to the last square, lattice point i, j is apron point i + 1, j + 1
+    int x0 = std::min(std::max(static_cast<int>(std::floor(gx)), 0), n - 1);
+    int z0 = std::min(std::max(static_cast<int>(std::floor(gz)), 0), n - 1);
+    const int side = TERRAIN_HEIGHTMAP_SIZE;
+    const float* row0 = apron + (x0 + 1) * side + z0 + 1;
+    const float* row1 = row0 + side;
+    return interpolateSquare(row0[0], row0[1], row1[0], row1[1], gx - x0, gz - z0, normal);
+}
+
+float terraingen::getNoiseHeight(float x, float z, int seed, glm::vec3* normal) {
+    float gx = x * TERRAIN_RESOLUTION;
+    float gz = z * TERRAIN_RESOLUTION;
+    int x0 = static_cast<int>(std::floor(gx));
+    int z0 = static_cast<int>(std::floor(gz));
+    return interpolateSquare(
+        getLatticeHeight(x0, z0, seed), getLatticeHeight(x0, z0 + 1, seed),
+        getLatticeHeight(x0 + 1, z0, seed), getLatticeHeight(x0 + 1, z0 + 1, seed),
+        gx - x0, gz - z0, normal
+    );
+}
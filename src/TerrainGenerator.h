@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Noise.h"
+
+// Terrain generation without any GL dependency. Everything here produces plain CPU
+// data so it can run on worker threads, in tools and on machines without a display;
+// uploading it is left to the app (see TerrainCell in Terrain.h).
+
+#define TERRAIN_RESOLUTION 2 // Number of lattice points in 1 unit along an axis.
+#define TERRAIN_CELL_SIZE 8
+#define TERRAIN_POINTS_PER_CELL TERRAIN_RESOLUTION * TERRAIN_CELL_SIZE
+#define TERRAIN_HEIGHT_STEPS 64 // Quantization steps per unit of height in packed terrain vertices.
+#define TERRAIN_HEIGHTMAP_SIZE (TERRAIN_POINTS_PER_CELL + 3) // Lattice plus a one point apron on each side.
+#define TERRAIN_TREE_GRID 4 // Tree slots along each side of a cell, at most one tree per slot.
+#define TERRAIN_TREE_DENSITY 0.125f // Chance of a slot holding a tree.
+#define TERRAIN_TREE_MARGIN 0.15f // Part of a slot kept free on each side, keeps neighbouring trees apart.
+
+// coordinates of a terrain cell, in cells
+struct CellKey {
+    int x, z;
+
+    bool operator==(const CellKey& other) const {
+        return x == other.x && z == other.z;
+    }
+};
+
+struct CellKeyHash {
+    size_t operator()(const CellKey& key) const {
+        return static_cast<size_t>(static_cast<unsigned int>(key.x)) * 73856093u ^ static_cast<unsigned int>(key.z) * 19349663u;
+    }
+};
+
+// Packed terrain vertex, one per lattice point of a cell. The local position is
+// (i, height, j) scaled by the lattice spacing and height quantum in terrain_vs.glsl
+// and texture coordinates are derived from it there.
+struct TerrainVertex {
+    unsigned char i, j;
+    signed char normal[2];  // octahedral encoding, snorm8
+    short height;           // in units of 1 / TERRAIN_HEIGHT_STEPS
+    unsigned char texture;  // sprite sheet index
+    unsigned char unused;
+};
+
+static_assert(sizeof(TerrainVertex) == 8, "TerrainVertex must stay tightly packed");
+
+enum class ObjectType {
+    TREE
+};
+
+// an object placed on the terrain, the app decides what model it is drawn with
+struct ObjectPlacement {
+    ObjectType type;
+    glm::vec3 pos;
+    glm::vec3 scale;
+};
+
+// everything generated for one terrain cell
+struct TerrainCellData {
+    int x, z;
+    // level of detail the lattice was generated at, only every 2^lod-th point is sampled
+    // from the noise and the rest are interpolated
+    int lod;
+    float latticePoints[TERRAIN_POINTS_PER_CELL + 1][TERRAIN_POINTS_PER_CELL + 1];
+    // one vertex per lattice point, row major, to be drawn with indices over the grid
+    std::vector<TerrainVertex> vertices;
+    // quantized heights including the apron, TERRAIN_HEIGHTMAP_SIZE squared
+    std::vector<short> heightmap;
+    // world space box around the lattice, objects are not included
+    glm::vec3 boundsMin, boundsMax;
+    std::vector<ObjectPlacement> objects;
+};
+
+namespace terraingen {
+    // Picks the noise the terrain is shaped by, the default preset unless set. Set it
+    // before generating anything, cells from different presets don't line up.
+    void setNoisePreset(const noise::NoisePreset& preset);
+    const noise::NoisePreset& getNoisePreset();
+    // Picks where the octaves come from, HASH unless set. Only TABLE gives every seed its
+    // own terrain, HASH is kept because it is what existing worlds were generated with.
+    void setNoiseBackend(NoiseBackend backend);
+    NoiseBackend getNoiseBackend();
+
+    // Generates the lattice, vertices, heightmap and object placements of a cell.
+    // Thread safe, the result only depends on the arguments and the noise settings.
+    TerrainCellData generateCell(int x, int z, int seed, int lod = 0);
+
+    // Samples the heights of a cell's lattice plus a one point apron, TERRAIN_HEIGHTMAP_SIZE
+    // squared floats written row major to apron. This is the noise part of generateCell.
+    void generateLattice(float* apron, int x, int z, int seed, int lod = 0);
+
+    // Builds everything generateCell does from heights already sampled into an apron
+    // like generateLattice writes, for cells whose heights were edited.
+    TerrainCellData buildCell(int x, int z, int seed, const float* apron, int lod = 0);
+    // Vertex of lattice point i, j of a cell, from the heights of the cell's apron. Only
+    // the point and its four direct neighbours are read.
+    TerrainVertex buildVertex(const float* apron, int i, int j);
+    // Copies apron heights into the cell's lattice points, and heightmap if it keeps one,
+    // and fits the bounds to them. Vertices and objects are left alone.
+    void setHeights(TerrainCellData& cell, const float* apron);
+    // places the cell's objects again on its current heights, replacing the old ones
+    void placeObjects(TerrainCellData& cell, int seed);
+
+    // raw terrain height at a lattice point, matches what generateCell produces for it
+    float getLatticeHeight(int gx, int gz, int seed);
+    // cell containing world x, z, rounding down so negative coordinates land in the right cell
+    CellKey getCellKey(float x, float z);
+    // Height of the terrain at world x, z, which must lie inside the cell, interpolated over
+    // the same two triangles per lattice square the cell mesh is drawn with. Writes the
+    // triangle's normal if normal isn't null. Throws std::runtime_error if x, z is outside.
+    float getHeight(const TerrainCellData& cell, float x, float z, glm::vec3* normal = nullptr);
+    // same as above but from the apron heights of the cell at key, like TerrainEdits keeps them
+    float getHeight(const float* apron, CellKey key, float x, float z, glm::vec3* normal = nullptr);
+    // same as above but evaluated straight from the noise, for points without a generated cell
+    float getNoiseHeight(float x, float z, int seed, glm::vec3* normal = nullptr);
+
+    short quantizeHeight(float height);
+}
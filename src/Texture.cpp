@@ -1,30 +1,48 @@
 #include "Texture.h"
-#include "stb_image.h"
+#include "RenderState.h"
+#include "WorkerPool.h"
+#include "Profiler.h"
 #include <glad/glad.h>
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
+#include <mutex>
 
-Texture::Texture(std::string const& imagePath) {
-    unsigned char* data = stbi_load(imagePath.c_str(), &this->width, &this->height, &this->nrChannels, 0);
-    if (!data) {
-        std::cout << "Failed to load texture" << std::endl;
-        return;
+// the baked image, or the decoded one if it isn't baked yet
+static TextureImage loadImage(std::string const& imagePath, int tileSize) {
+    TextureImage image;
+    if (!texturecache::load(imagePath, tileSize, image) && !texturecache::decode(imagePath, tileSize, image)) {
+        std::cout << "Failed to load texture " << imagePath << std::endl;
     }
+    return image;
+}
+
+Texture::Texture(std::string const& imagePath, int tileSize) : Texture(loadImage(imagePath, tileSize)) {}
+
+Texture::Texture(const TextureImage& image)
+    : width(image.width), height(image.height), layers(image.layers), target(image.array ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D) {
+    PROFILE_ZONE("Texture::Texture");
+    PROFILE_COUNTER(ProfileCounter::BYTES_UPLOADED, image.getSize());
     glGenTextures(1, &this->texture);
-    std::cout << imagePath << ": " << &this->texture << " " << this->texture << std::endl;
-    glBindTexture(GL_TEXTURE_2D, this->texture);
+    renderstate::bindTexture(0, this->target, this->texture);
     
     // set parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-    // load the texture data
-    GLenum format = this->nrChannels == 3 ? GL_RGB : GL_RGBA;
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, this->width, this->height, 0, format, GL_UNSIGNED_BYTE, data);
-    
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data);
+    glTexParameteri(this->target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(this->target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(this->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(this->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(this->target, GL_TEXTURE_MAX_LEVEL, std::max(image.levels - 1, 0));
+
+    // the mip chain comes with the image, level by level
+    for (int level = 0; level < image.levels; level++) {
+        const unsigned char* pixels = image.pixels + image.getLevelOffset(level);
+        if (this->target == GL_TEXTURE_2D_ARRAY) {
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, image.getLevelWidth(level), image.getLevelHeight(level), image.layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, image.getLevelWidth(level), image.getLevelHeight(level), 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        }
+    }
 
     this->unbind();
 }
@@ -34,18 +52,20 @@ Texture::~Texture() {
 }
 
 void Texture::bind() const {
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, this->texture);
+    renderstate::bindTexture(0, this->target, this->texture);
 }
 
 void Texture::bind(Shader const& shader, std::string const& uniformName) const {
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, this->texture);
+    renderstate::bindTexture(0, this->target, this->texture);
     shader.setInt(uniformName.c_str(), 0);
 }
 
 void Texture::unbind() const {
-    glBindTexture(GL_TEXTURE_2D, 0);
+    renderstate::bindTexture(0, this->target, 0);
+}
+
+unsigned int Texture::getId() const {
+    return this->texture;
 }
 
 TexPtr textures::SMILE;
@@ -54,10 +74,80 @@ TexPtr textures::GRASS;
 TexPtr textures::GALAXY;
 TexPtr textures::MINECRAFT;
 
+struct TextureSource {
+    TexPtr* texture;
+    const char* path;
+    int tileSize;
+};
+
+static const TextureSource textureSources[] = {
+    {&textures::SMILE, "assets/smile.png", 0},
+    {&textures::WOOD, "assets/wood.png", 0},
+    {&textures::GRASS, "assets/grass.png", 0},
+    {&textures::GALAXY, "assets/galaxy.png", 0},
+    {&textures::MINECRAFT, "assets/minecraft.png", TEXTURE_ATLAS_TILE_SIZE},
+};
+
+#define NUM_TEXTURE_SOURCES (sizeof(textureSources) / sizeof(textureSources[0]))
+
+// Gets the image of every source. Baked images are mapped on this thread, the others are
+// decoded and baked on worker threads. ready runs on this thread for each image as soon
+// as it is available, so uploads overlap the decoding of the rest.
+static void loadImages(bool useCache, const std::function<void(const TextureSource&, const TextureImage&)>& ready) {
+    std::vector<TextureImage> images(NUM_TEXTURE_SOURCES);
+    std::mutex mutex;
+    std::condition_variable available;
+    std::vector<size_t> finished;
+    std::unique_ptr<WorkerPool> decoders;
+    for (size_t i = 0; i < NUM_TEXTURE_SOURCES; i++) {
+        const TextureSource& source = textureSources[i];
+        if (useCache && texturecache::load(source.path, source.tileSize, images[i])) {
+            finished.push_back(i);
+            continue;
+        }
+        if (decoders == nullptr) {
+            decoders = std::make_unique<WorkerPool>();
+        }
+        decoders->submit([&, i]() {
+            const TextureSource& source = textureSources[i];
+            TextureImage image;
+            if (texturecache::decode(source.path, source.tileSize, image)) {
+                texturecache::save(source.path, source.tileSize, image);
+            } else {
+                std::cout << "Failed to load texture " << source.path << std::endl;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            images[i] = std::move(image);
+            finished.push_back(i);
+            available.notify_one();
+        });
+    }
+    for (size_t done = 0; done < NUM_TEXTURE_SOURCES; done++) {
+        size_t i;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            available.wait(lock, [&finished]() { return !finished.empty(); });
+            i = finished.back();
+            finished.pop_back();
+        }
+        ready(textureSources[i], images[i]);
+        // let go of the pixels or the mapping as soon as they are uploaded
+        images[i] = TextureImage();
+    }
+}
+
 void textures::initialize() {
-    SMILE = std::make_unique<Texture>("assets/smile.png");
-    WOOD = std::make_unique<Texture>("assets/wood.png");
-    GRASS = std::make_unique<Texture>("assets/grass.png");
-    GALAXY = std::make_unique<Texture>("assets/galaxy.png");
-    MINECRAFT = std::make_unique<Texture>("assets/minecraft.png");
-}
\ No newline at end of file
+    PROFILE_ZONE("textures::initialize");
+    loadImages(true, [](const TextureSource& source, const TextureImage& image) {
+        *source.texture = std::make_unique<Texture>(image);
+    });
+}
+
+void textures::bake() {
+    PROFILE_ZONE("textures::bake");
+    loadImages(false, [](const TextureSource& source, const TextureImage& image) {
+        if (image.levels > 0) {
+            std::cout << "baked " << texturecache::getPath(source.path, source.tileSize) << std::endl;
+        }
+    });
+}
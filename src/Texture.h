@@ -1,20 +1,29 @@
 #pragma once
 
 #include "Shader.h"
+#include "TextureCache.h"
 
 #include <string>
 
+#define TEXTURE_ATLAS_TILE_SIZE 16 // Pixels along each side of a sprite in minecraft.png.
+
 class Texture {
 private:
-    int width, height, nrChannels;
+    int width, height, layers;
+    // GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY for images cut into tiles
+    unsigned int target;
     unsigned int texture;
 public:
-    Texture(std::string const& imagePath);
+    // loads the baked image if there is one, otherwise decodes it, see texturecache::decode
+    Texture(std::string const& imagePath, int tileSize = 0);
+    // uploads every level of the image
+    Texture(const TextureImage& image);
     ~Texture();
 
     void bind() const;
     void bind(Shader const& shader, std::string const& uniformName) const;
     void unbind() const;
+    unsigned int getId() const;
 };
 
 
@@ -25,7 +34,12 @@ namespace textures {
     extern TexPtr WOOD;
     extern TexPtr GRASS;
     extern TexPtr GALAXY;
+    // the terrain sprite sheet as an array texture, one sprite per layer
     extern TexPtr MINECRAFT;
 
+    // Loads every texture. Baked images are mapped, the rest are decoded on worker threads
+    // and baked for the next launch.
     void initialize();
-}
\ No newline at end of file
+    // Decodes every image again and rewrites its cache file, needs no GL context.
+    void bake();
+}
@@ -0,0 +1,203 @@
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+// the only user of stb_image, so its implementation lives here
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "Profiler.h"
+
+#define TEXTURE_CACHE_HEADER_SIZE 40
+
+static const char textureMagic[4] = {'T', 'T', 'E', 'X'};
+
+int TextureImage::getLevelWidth(int level) const {
+    return std::max(width >> level, 1);
+}
+
+int TextureImage::getLevelHeight(int level) const {
+    return std::max(height >> level, 1);
+}
+
+size_t TextureImage::getLevelOffset(int level) const {
+    size_t offset = 0;
+    for (int l = 0; l < level; l++) {
+        offset += static_cast<size_t>(getLevelWidth(l)) * getLevelHeight(l) * layers * 4;
+    }
+    return offset;
+}
+
+size_t TextureImage::getSize() const {
+    return getLevelOffset(levels);
+}
+
+// size and modification time of the source image, the cache entry is stale if either changed
+static bool getSourceStamp(const std::string& imagePath, int64_t stamp[2]) {
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(imagePath, error);
+    if (error) {
+        return false;
+    }
+    auto modified = std::filesystem::last_write_time(imagePath, error);
+    if (error) {
+        return false;
+    }
+    stamp[0] = static_cast<int64_t>(size);
+    stamp[1] = static_cast<int64_t>(modified.time_since_epoch().count());
+    return true;
+}
+
+// halves a level with a box filter, odd edges repeat their last texel
+static void downsample(const unsigned char* src, int width, int height, unsigned char* dst, int dstWidth, int dstHeight) {
+    for (int y = 0; y < dstHeight; y++) {
+        int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+        for (int x = 0; x < dstWidth; x++) {
+            int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+            for (int c = 0; c < 4; c++) {
+                int sum = src[(y0 * width + x0) * 4 + c] + src[(y0 * width + x1) * 4 + c]
+                        + src[(y1 * width + x0) * 4 + c] + src[(y1 * width + x1) * 4 + c];
+                dst[(y * dstWidth + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+std::string texturecache::getPath(const std::string& imagePath, int tileSize) {
+    std::string name = std::filesystem::path(imagePath).filename().string();
+    if (tileSize > 0) {
+        name += "." + std::to_string(tileSize);
+    }
+    return std::string(TEXTURE_CACHE_DIRECTORY) + "/" + name + ".tex";
+}
+
+bool texturecache::load(const std::string& imagePath, int tileSize, TextureImage& image) {
+    PROFILE_ZONE("texturecache::load");
+    int64_t stamp[2];
+    if (!getSourceStamp(imagePath, stamp)) {
+        return false;
+    }
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(getPath(imagePath, tileSize)) || file->size < TEXTURE_CACHE_HEADER_SIZE) {
+        return false;
+    }
+    int32_t header[5];
+    int64_t savedStamp[2];
+    std::memcpy(header, file->data + 4, sizeof(header));
+    std::memcpy(savedStamp, file->data + 24, sizeof(savedStamp));
+    if (std::memcmp(file->data, textureMagic, 4) != 0 || header[0] != TEXTURE_CACHE_VERSION
+        || savedStamp[0] != stamp[0] || savedStamp[1] != stamp[1]) {
+        return false;
+    }
+    TextureImage loaded;
+    loaded.width = header[1];
+    loaded.height = header[2];
+    loaded.layers = header[3];
+    loaded.levels = header[4];
+    loaded.array = tileSize > 0;
+    if (loaded.width <= 0 || loaded.height <= 0 || loaded.layers <= 0 || loaded.levels <= 0
+        || TEXTURE_CACHE_HEADER_SIZE + loaded.getSize() != file->size) {
+        return false;
+    }
+    loaded.pixels = reinterpret_cast<const unsigned char*>(file->data + TEXTURE_CACHE_HEADER_SIZE);
+    loaded.file = std::move(file);
+    image = std::move(loaded);
+    return true;
+}
+
+bool texturecache::decode(const std::string& imagePath, int tileSize, TextureImage& image) {
+    PROFILE_ZONE("texturecache::decode");
+    int width, height, channels;
+    unsigned char* data = stbi_load(imagePath.c_str(), &width, &height, &channels, 4);
+    if (data == nullptr) {
+        return false;
+    }
+    TextureImage decoded;
+    decoded.array = tileSize > 0;
+    if (decoded.array) {
+        decoded.width = tileSize;
+        decoded.height = tileSize;
+        decoded.layers = (width / tileSize) * (height / tileSize);
+    } else {
+        decoded.width = width;
+        decoded.height = height;
+    }
+    decoded.levels = 1;
+    while ((std::max(decoded.width, decoded.height) >> decoded.levels) > 0) {
+        decoded.levels++;
+    }
+    if (decoded.layers == 0) {
+        stbi_image_free(data);
+        return false;
+    }
+    decoded.owned.resize(decoded.getSize());
+
+    // level 0, images are decoded top row first
+    unsigned char* level = decoded.owned.data();
+    const size_t rowSize = static_cast<size_t>(decoded.width) * 4;
+    if (decoded.array) {
+        const int columns = width / tileSize;
+        for (int layer = 0; layer < decoded.layers; layer++) {
+            int tileX = (layer % columns) * tileSize, tileY = (layer / columns) * tileSize;
+            for (int y = 0; y < tileSize; y++) {
+                std::memcpy(level + (static_cast<size_t>(layer) * tileSize + y) * rowSize,
+                            data + (static_cast<size_t>(tileY + y) * width + tileX) * 4, rowSize);
+            }
+        }
+    } else {
+        for (int y = 0; y < height; y++) {
+            std::memcpy(level + static_cast<size_t>(height - 1 - y) * rowSize, data + y * rowSize, rowSize);
+        }
+    }
+    stbi_image_free(data);
+
+    for (int l = 1; l < decoded.levels; l++) {
+        const int srcWidth = decoded.getLevelWidth(l - 1), srcHeight = decoded.getLevelHeight(l - 1);
+        const int dstWidth = decoded.getLevelWidth(l), dstHeight = decoded.getLevelHeight(l);
+        const unsigned char* src = decoded.owned.data() + decoded.getLevelOffset(l - 1);
+        unsigned char* dst = decoded.owned.data() + decoded.getLevelOffset(l);
+        for (int layer = 0; layer < decoded.layers; layer++) {
+            downsample(src + static_cast<size_t>(layer) * srcWidth * srcHeight * 4, srcWidth, srcHeight,
+                       dst + static_cast<size_t>(layer) * dstWidth * dstHeight * 4, dstWidth, dstHeight);
+        }
+    }
+    decoded.pixels = decoded.owned.data();
+    image = std::move(decoded);
+    return true;
+}
+
+bool texturecache::save(const std::string& imagePath, int tileSize, const TextureImage& image) {
+    PROFILE_ZONE("texturecache::save");
+    int64_t stamp[2];
+    if (!getSourceStamp(imagePath, stamp)) {
+        return false;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(TEXTURE_CACHE_DIRECTORY, error);
+    int32_t header[5] = {TEXTURE_CACHE_VERSION, image.width, image.height, image.layers, image.levels};
+
+    // write next to the old file and swap it in so a running load never sees a partial file
+    std::string path = getPath(imagePath, tileSize);
+    std::string tempPath = path + ".tmp";
+    bool written;
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        out.write(textureMagic, 4);
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(stamp), sizeof(stamp));
+        out.write(reinterpret_cast<const char*>(image.pixels), image.getSize());
+        written = static_cast<bool>(out);
+    }
+    if (written) {
+        std::filesystem::rename(tempPath, path, error);
+    }
+    if (!written || error) {
+        std::cout << "texturecache: could not write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+
+#define TEXTURE_CACHE_DIRECTORY "assets/cache" // Baked images, relative to the working directory.
+#define TEXTURE_CACHE_VERSION 1 // Bump whenever the file layout or the mip filter changes.
+
+// RGBA8 pixels of a texture and its whole mip chain, from full size down to 1x1. Levels
+// follow each other and each level holds every layer. The pixels are either owned or
+// point into a mapped cache file.
+struct TextureImage {
+    int width = 0;
+    int height = 0;
+    // layers of an array texture, 1 for a plain 2D texture
+    int layers = 1;
+    int levels = 0;
+    bool array = false;
+    const unsigned char* pixels = nullptr;
+
+    std::vector<unsigned char> owned;
+    std::shared_ptr<MappedFile> file;
+
+    int getLevelWidth(int level) const;
+    int getLevelHeight(int level) const;
+    // byte offset of the level's first layer
+    size_t getLevelOffset(int level) const;
+    // bytes of every level
+    size_t getSize() const;
+};
+
+// Decoding a png and building its mips on every launch is slow, so images are baked into
+// cache files of their decoded levels that are mapped and uploaded as they are. A baked
+// image remembers the size and modification time of its source and is ignored once the
+// source changes.
+//
+// Cache file layout, native byte order:
+//   header: "TTEX", version, width, height, layers, levels    (6 x 4 bytes)
+//           source size, source modification time              (2 x 8 bytes)
+//   pixels: every level as laid out in TextureImage
+namespace texturecache {
+    // <TEXTURE_CACHE_DIRECTORY>/<image file name>.tex, or .<tileSize>.tex for an array
+    std::string getPath(const std::string& imagePath, int tileSize);
+
+    // Maps the baked form of the image. Returns false if it has none or it is out of date.
+    bool load(const std::string& imagePath, int tileSize, TextureImage& image);
+    // Decodes the image and builds its mip chain. Plain images are stored bottom row first
+    // as GL expects. With tileSize > 0 the image is cut into tileSize squared tiles instead,
+    // one layer each in row major order from the top left, stored top row first. Thread safe.
+    bool decode(const std::string& imagePath, int tileSize, TextureImage& image);
+    // Writes a decoded image to its cache file. Thread safe for different images.
+    bool save(const std::string& imagePath, int tileSize, const TextureImage& image);
+}
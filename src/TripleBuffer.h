@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+
+// Hands the newest value from one writer thread to one reader thread without locks.
+// The writer fills its back slot and publishes it, the reader takes whatever was
+// published last. Neither side ever waits, values published between two reads are
+// skipped.
+template <typename T>
+class TripleBuffer {
+private:
+    static constexpr int INDEX = 3;
+    // set on the middle index when it holds a value the reader hasn't taken
+    static constexpr int FRESH = 4;
+
+    T slots[3];
+    // slot between the two sides, handed over by exchanging it with the back or front
+    std::atomic<int> middle{1};
+    // writer only
+    int back = 0;
+    // reader only
+    int front = 2;
+public:
+    TripleBuffer() = default;
+    explicit TripleBuffer(const T& initial) : slots{initial, initial, initial} {}
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // the slot the writer fills next, it keeps whatever was in it two publishes ago
+    T& getBack() {
+        return slots[back];
+    }
+
+    // makes the back slot the newest value
+    void publish() {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // the newest published value, or the one read last time if nothing new was published
+    const T& read() {
+        if (middle.load(std::memory_order_relaxed) & FRESH) {
+            front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        }
+        return slots[front];
+    }
+};
@@ -0,0 +1,136 @@
+#include "VertexArena.h"
+#include "RenderState.h"
+#include "Profiler.h"
+
+#include <glad/glad.h>
+
+// Copies size bytes from the start of one buffer into a new buffer of newSize bytes,
+// deletes the old one and returns the new one.
+static unsigned int growBuffer(unsigned int buffer, size_t size, size_t newSize) {
+    unsigned int grown;
+    glGenBuffers(1, &grown);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+    glBufferData(GL_COPY_WRITE_BUFFER, newSize, nullptr, GL_STATIC_DRAW);
+    if (buffer != 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+        glDeleteBuffers(1, &buffer);
+    }
+    return grown;
+}
+
+VertexArena::VertexArena(const VertexAttribSet& attribSet, int slotVertices, int capacity, const IndexBuffer* indices)
+    : attribSet(attribSet), slotVertices(slotVertices), indices(indices) {
+    for (const VertexAttribute& attrib : attribSet) {
+        stride += attrib.numElements * attrib.sizeOfType;
+    }
+    glGenVertexArrays(1, &vao);
+    glGenTextures(1, &originTexture);
+    reserve(capacity);
+}
+
+VertexArena::~VertexArena() {
+    renderstate::forgetVertexArray(vao);
+    renderstate::forgetTexture(originTexture);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+    glDeleteTextures(1, &originTexture);
+    glDeleteBuffers(1, &originBuffer);
+}
+
+void VertexArena::bindAttributes() {
+    renderstate::bindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    size_t byteOffset = 0;
+    for (size_t i = 0; i < attribSet.size(); i++) {
+        const VertexAttribute& attrib = attribSet[i];
+        if (attrib.integer) {
+            glVertexAttribIPointer(i, attrib.numElements, attrib.type, stride, (void*) byteOffset);
+        } else {
+            glVertexAttribPointer(i, attrib.numElements, attrib.type, attrib.normalized ? GL_TRUE : GL_FALSE, stride, (void*) byteOffset);
+        }
+        byteOffset += attrib.numElements * attrib.sizeOfType;
+        glEnableVertexAttribArray(i);
+    }
+    // the element buffer binding is part of the vertex array state
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices->getId());
+}
+
+bool VertexArena::reserve(int capacity) {
+    if (capacity <= this->capacity) {
+        return false;
+    }
+    PROFILE_ZONE("VertexArena::reserve");
+    size_t slotSize = stride * slotVertices;
+    vbo = growBuffer(vbo, slotSize * this->capacity, slotSize * capacity);
+    originBuffer = growBuffer(originBuffer, sizeof(glm::ivec2) * this->capacity, sizeof(glm::ivec2) * capacity);
+    bindAttributes();
+    renderstate::bindTexture(0, GL_TEXTURE_BUFFER, originTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32I, originBuffer);
+    renderstate::bindTexture(0, GL_TEXTURE_BUFFER, 0);
+
+    // new slots go at the back so lower slots are handed out first
+    std::vector<int> added;
+    for (int slot = capacity - 1; slot >= this->capacity; slot--) {
+        added.push_back(slot);
+    }
+    freeSlots.insert(freeSlots.begin(), added.begin(), added.end());
+    this->capacity = capacity;
+    return true;
+}
+
+int VertexArena::allocate() {
+    if (freeSlots.empty()) {
+        return -1;
+    }
+    int slot = freeSlots.back();
+    freeSlots.pop_back();
+    return slot;
+}
+
+void VertexArena::release(int slot) {
+    freeSlots.push_back(slot);
+}
+
+void VertexArena::upload(int slot, const void* vertices, glm::ivec2 origin) {
+    PROFILE_ZONE("VertexArena::upload");
+    PROFILE_COUNTER(ProfileCounter::BYTES_UPLOADED, stride * slotVertices + sizeof(origin));
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, stride * slotVertices * slot, stride * slotVertices, vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, originBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(origin) * slot, sizeof(origin), &origin);
+}
+
+void VertexArena::update(int slot, const void* vertices, int firstVertex, int numVertices) {
+    PROFILE_COUNTER(ProfileCounter::BYTES_UPLOADED, stride * numVertices);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, stride * (slotVertices * slot + firstVertex), stride * numVertices, vertices);
+}
+
+void VertexArena::add(int slot, IndexRange range) {
+    counts.push_back(static_cast<int>(range.count));
+    offsets.push_back((void*) (range.first * sizeof(unsigned short)));
+    baseVertices.push_back(slot * slotVertices);
+}
+
+void VertexArena::draw(int originUnit) {
+    if (counts.empty()) {
+        return;
+    }
+    PROFILE_ZONE("VertexArena::draw");
+    renderstate::bindVertexArray(vao);
+    renderstate::bindTexture(originUnit, GL_TEXTURE_BUFFER, originTexture);
+    renderstate::countDraw();
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_SHORT, offsets.data(), static_cast<int>(counts.size()), baseVertices.data());
+    counts.clear();
+    offsets.clear();
+    baseVertices.clear();
+}
+
+int VertexArena::getCapacity() const {
+    return capacity;
+}
+
+int VertexArena::getSlotVertices() const {
+    return slotVertices;
+}
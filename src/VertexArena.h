@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+
+// A single vertex buffer split into equal slots, one per terrain cell, behind one vertex
+// array so every queued cell is drawn with one glMultiDrawElementsBaseVertex. Each slot
+// also has an origin in a buffer texture, the vertex shader finds its slot's origin
+// through gl_VertexID / slotVertices (gl_VertexID includes the base vertex).
+class VertexArena {
+private:
+    unsigned int vao = 0;
+    unsigned int vbo = 0;
+    // one ivec2 per slot, read as a buffer texture
+    unsigned int originBuffer = 0;
+    unsigned int originTexture = 0;
+    VertexAttribSet attribSet;
+    size_t stride = 0;
+    int slotVertices;
+    const IndexBuffer* indices;
+    int capacity = 0;
+    std::vector<int> freeSlots;
+
+    // draws queued since the last draw call
+    std::vector<int> counts;
+    std::vector<const void*> offsets;
+    std::vector<int> baseVertices;
+
+    // points the vertex array's attributes at the current buffer
+    void bindAttributes();
+public:
+    // Every slot holds slotVertices vertices laid out by attribSet. Draws use the index
+    // buffer, which must outlive the arena, with indices relative to the slot.
+    VertexArena(const VertexAttribSet& attribSet, int slotVertices, int capacity, const IndexBuffer* indices);
+    ~VertexArena();
+
+    VertexArena(const VertexArena&) = delete;
+    VertexArena& operator=(const VertexArena&) = delete;
+
+    // Grows the buffer to hold at least capacity slots. The contents are copied over on
+    // the GPU so slots keep their vertices and origins. Returns true if it grew.
+    bool reserve(int capacity);
+
+    // returns a free slot or -1 if the arena is full
+    int allocate();
+    void release(int slot);
+    // uploads all of the slot's vertices and its origin
+    void upload(int slot, const void* vertices, glm::ivec2 origin);
+    // overwrites numVertices of the slot's vertices starting at firstVertex
+    void update(int slot, const void* vertices, int firstVertex, int numVertices);
+
+    // queues a draw of the range of the index buffer over the slot's vertices
+    void add(int slot, IndexRange range);
+    // Draws everything queued in one call and clears the queue. The shader in use must
+    // read the origins from the sampler bound to originUnit.
+    void draw(int originUnit);
+    int getCapacity() const;
+    int getSlotVertices() const;
+};
@@ -0,0 +1,51 @@
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(unsigned int numThreads) {
+    if (numThreads == 0) {
+        unsigned int cores = std::thread::hardware_concurrency();
+        numThreads = cores > 1 ? cores - 1 : 1;
+    }
+    for (unsigned int i = 0; i < numThreads; i++) {
+        threads.emplace_back(&WorkerPool::run, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        jobs.clear();
+    }
+    available.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    available.notify_one();
+}
+
+size_t WorkerPool::getNumThreads() const {
+    return threads.size();
+}
+
+void WorkerPool::run() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            available.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if (stopping) {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of background threads that run submitted jobs in FIFO order.
+class WorkerPool {
+private:
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool stopping = false;
+
+    void run();
+public:
+    // numThreads == 0 picks one thread per hardware core, leaving one for the render thread
+    WorkerPool(unsigned int numThreads = 0);
+    // drops jobs that have not started yet and waits for running ones to finish
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void submit(std::function<void()> job);
+    size_t getNumThreads() const;
+};
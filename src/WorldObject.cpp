@@ -3,6 +3,8 @@
 #include "Mesh.h"
 #include "Texture.h"
 
+#include <cmath>
+
 #include <glm/gtc/matrix_transform.hpp>
 
 void WorldObject::render(Shader& objectShader) const {
@@ -17,6 +19,17 @@ void WorldObject::render(Shader& objectShader) const {
     };
 }
 
+void WorldObject::getBounds(glm::vec3& min, glm::vec3& max) const {
+    min = glm::vec3(INFINITY);
+    max = glm::vec3(-INFINITY);
+    for (const auto & part : model) {
+        glm::vec3 center = pos + part->offsetPosition;
+        glm::vec3 half = (scale + part->scale) * 0.5f;
+        min = glm::min(min, center - half);
+        max = glm::max(max, center + half);
+    }
+}
+
 Model models::TREE;
 
 void models::initialize() {
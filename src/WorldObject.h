@@ -27,6 +27,8 @@ struct WorldObject {
     float angle;
 
     void render(Shader& objectShader) const;
+    // world space box around every part, parts are taken to span a unit cube like meshes::CUBE
+    void getBounds(glm::vec3& min, glm::vec3& max) const;
 };
 
 namespace models {
@@ -1,11 +1,11 @@
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
+#include <algorithm>
+#include <chrono>
 #include <stdexcept>
 #include <iostream>
 
 #include <vector>
 #include <unordered_map>
+#include <string>
 
 #include <SDL.h>
 #include <glad/glad.h>
@@ -15,9 +15,14 @@
 #include "Shader.h"
 #include "Texture.h"
 #include "Math.h"
+#include "Noise.h"
 #include "Terrain.h"
 #include "Mesh.h"
 #include "WorldObject.h"
+#include "Frustum.h"
+#include "RenderState.h"
+#include "Profiler.h"
+#include "Simulation.h"
 
 int resizeEventWatcher(void* data, SDL_Event* event) {
     if (event->type == SDL_WINDOWEVENT && event->window.event == SDL_WINDOWEVENT_RESIZED) {
@@ -30,9 +35,80 @@ int resizeEventWatcher(void* data, SDL_Event* event) {
     return 0;
 }
 
-int program() {
-    stbi_set_flip_vertically_on_load(true);  
-    
+// Marches along the ray from eye until it goes below the terrain. Returns false if it
+// doesn't within maxDistance, otherwise hit is the first point found under the surface.
+bool pickTerrain(Terrain& terrain, glm::vec3 eye, glm::vec3 direction, float maxDistance, glm::vec3& hit) {
+    const float step = 0.25f;
+    for (float t = step; t <= maxDistance; t += step) {
+        glm::vec3 point = eye + direction * t;
+        glm::vec2 xz(point.x, point.z);
+        float height;
+        terrain.getHeights(&xz, 1, &height);
+        if (point.y <= height) {
+            hit = glm::vec3(point.x, height, point.z);
+            return true;
+        }
+    }
+    return false;
+}
+
+int program(int argc, char** argv) {
+    // --heightmap displaces a shared grid on the GPU instead of uploading a mesh per cell
+    // --render-distance <cells> sets the radius of terrain drawn around the camera
+    // --render-stats prints the draws and GL state changes of a frame every second
+    // --world <directory> keeps generated cells on disk and loads them from there
+    // --noise <preset> picks the noise the terrain is shaped by, see noise::getPresets
+    // --noise-backend <hash|table> picks where the noise comes from, only table varies with the seed
+    // --seed <seed> seeds the terrain, with the hash backend only the tree placement
+    // --bake-textures rewrites the baked texture cache and exits, see texturecache
+    TerrainRenderMode terrainMode = TerrainRenderMode::MESH;
+    int renderDistance = TERRAIN_RENDER_DISTANCE;
+    bool printRenderStats = false;
+    std::string worldDirectory;
+    int seed = 3284;
+    bool seedGiven = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--heightmap") {
+            terrainMode = TerrainRenderMode::HEIGHTMAP;
+        } else if (arg == "--render-distance" && i + 1 < argc) {
+            renderDistance = std::stoi(argv[++i]);
+        } else if (arg == "--world" && i + 1 < argc) {
+            worldDirectory = argv[++i];
+        } else if (arg == "--render-stats") {
+            printRenderStats = true;
+        } else if (arg == "--noise" && i + 1 < argc) {
+            const noise::NoisePreset* preset = noise::findPreset(argv[++i]);
+            if (preset == nullptr) {
+                std::cout << "unknown noise preset " << argv[i] << ", available:";
+                for (const noise::NoisePreset& available : noise::getPresets()) {
+                    std::cout << " " << available.name;
+                }
+                std::cout << std::endl;
+                return 1;
+            }
+            terraingen::setNoisePreset(*preset);
+        } else if (arg == "--noise-backend" && i + 1 < argc) {
+            NoiseBackend backend;
+            if (!noise::findBackend(argv[++i], backend)) {
+                std::cout << "unknown noise backend " << argv[i] << ", available: hash table" << std::endl;
+                return 1;
+            }
+            terraingen::setNoiseBackend(backend);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::stoi(argv[++i]);
+            seedGiven = true;
+        } else if (arg == "--bake-textures") {
+            textures::bake();
+            return 0;
+        }
+    }
+
+    if (seedGiven && terraingen::getNoiseBackend() == NoiseBackend::HASH) {
+        std::cout << "warning: the hash noise backend is the same for every seed, --seed only moves the trees."
+                  << " Add --noise-backend table for terrain of its own" << std::endl;
+    }
+
     SDL_Init(SDL_INIT_VIDEO);
     
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3); // For example, OpenGL 3.3
@@ -47,6 +123,7 @@ int program() {
     {
         throw std::runtime_error("Failed to initialize GLAD");
     }
+    shaders::initialize((GLADloadproc)SDL_GL_GetProcAddress);
 
     meshes::initialize();
     textures::initialize();
@@ -62,145 +139,199 @@ int program() {
 
     Shader waterShader("assets/vs.glsl", "assets/water_fs.glsl");
     Shader objectShader("assets/vs.glsl", "assets/fs.glsl");
-    Shader terrainShader("assets/terrain_vs.glsl", "assets/terrain_fs.glsl");
+    Shader instancedShader("assets/instanced_vs.glsl", "assets/fs.glsl");
+    Shader terrainShader(
+        terrainMode == TerrainRenderMode::HEIGHTMAP ? "assets/terrain_heightmap_vs.glsl" : "assets/terrain_vs.glsl",
+        "assets/terrain_fs.glsl"
+    );
 
     std::unique_ptr<Part> part = std::make_unique<Part>(Part{*meshes::CUBE, *textures::WOOD, glm::vec3(0), glm::vec3(0)});
 
-    Terrain terrain(3284);
+    // declared before the terrain so its workers are done with the store before it flushes
+    std::unique_ptr<RegionStore> regionStore;
+    if (!worldDirectory.empty()) {
+        regionStore = std::make_unique<RegionStore>(worldDirectory, seed);
+    }
+    Terrain terrain(seed, terrainMode, regionStore.get());
+    terrain.setRenderDistance(renderDistance);
 
     bool gameActive = true;
 
+    // camera physics run on their own thread, the look direction stays here so it follows the mouse every frame
+    Simulation simulation(terrain, glm::vec3(1000.0f, 0.0f, 1000.0f));
+    SimulationInput input;
     glm::vec3 cameraPosition(1000.0f, 0.0f, 1000.0f);
     glm::vec3 cameraForward(0.0f, 0.0f, -1.0f);
-    glm::vec3 cameraRight(1.0f, 0.0f, 0.0f);
-    glm::vec3 cameraVelocity(0.0f);
     float cameraRotation = 0.0f;
     float cameraVerticalRotation = 0.0f;
 
-    float gravity = 10.0f;
+    // sculpting: hold R to raise, F to lower, G to flatten the terrain the camera looks at
+    const float brushRadius = 3.0f;
+    const float brushRate = 4.0f; // height change per second at the brush's center
+    const float brushReach = 32.0f;
 
-    float lastTime = static_cast<float>(SDL_GetTicks()) / 1000.0f;
+    using clock = std::chrono::steady_clock;
+    const clock::time_point startTime = clock::now();
+    float lastTime = 0.0f;
 
     std::unordered_map<int, bool> keydown;
 
     bool cursorLocked = false;
 
+    float lastStatsTime = lastTime;
+
     while (gameActive) {
-        float currTime = static_cast<float>(SDL_GetTicks()) / 1000.0f;
+        clock::time_point now = clock::now();
+        float currTime = std::chrono::duration<float>(now - startTime).count();
         float dt = currTime - lastTime;
         lastTime = currTime;
 
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-                case SDL_QUIT:
-                    gameActive = false;
-                    break;
-                case SDL_KEYDOWN:
-                    keydown[event.key.keysym.sym] = true;
-                    switch (event.key.keysym.sym) {
-                        case SDLK_ESCAPE:
-                            cursorLocked = false;
-                            break;
-                        case SDLK_SPACE:
-                            cameraVelocity.y = 5.0f;
-                    }
-                    break;
-                case SDL_KEYUP:
-                    keydown[event.key.keysym.sym] = false;
-                    break;
-                case SDL_MOUSEMOTION:
-                    if (cursorLocked) {
-                        cameraRotation -= event.motion.xrel / 250.0f;
-                        cameraVerticalRotation = math::clampf(cameraVerticalRotation - event.motion.yrel / 250.0f, -M_PI * 0.6f, M_PI * 0.6f);
-                    }
-                    break;
-                case SDL_MOUSEBUTTONDOWN:
-                    cursorLocked = true;
-                    break;
-            }
+        PROFILE_FRAME();
+        renderstate::beginFrame();
+        if (printRenderStats && currTime - lastStatsTime >= 1.0f) {
+            const RenderStats& stats = renderstate::getLastFrameStats();
+            std::cout << "draws: " << stats.drawCalls
+                      << ", programs: " << stats.programChanges
+                      << ", textures: " << stats.textureChanges
+                      << ", vertex arrays: " << stats.vertexArrayChanges
+                      << ", skipped: " << stats.redundantChanges << "\n";
+            lastStatsTime = currTime;
         }
 
-        SDL_SetRelativeMouseMode(static_cast<SDL_bool>(cursorLocked)); 
-
-        cameraForward = glm::vec3(-sinf(cameraRotation), sinf(cameraVerticalRotation), -cosf(cameraRotation));
-        cameraRight = glm::vec3(cosf(cameraRotation), 0.0f, -sinf(cameraRotation));
-        glm::vec3 cameraUp = glm::cross(cameraRight, cameraForward);
-        cameraVelocity = glm::vec3(0.0f, cameraVelocity.y, 0.0f);
-        float speed = 5.0f;
-        float modGravity = gravity;
-        if (cameraPosition.y <= 2.0f) {
-            speed /= 2.0f;
-            modGravity /= 6.0f;
+        {
+            PROFILE_ZONE("input");
+            SDL_Event event;
+            while (SDL_PollEvent(&event)) {
+                switch (event.type) {
+                    case SDL_QUIT:
+                        gameActive = false;
+                        break;
+                    case SDL_KEYDOWN:
+                        keydown[event.key.keysym.sym] = true;
+                        switch (event.key.keysym.sym) {
+                            case SDLK_ESCAPE:
+                                cursorLocked = false;
+                                break;
+                            case SDLK_SPACE:
+                                input.jumps++;
+                                break;
+#ifdef PROFILE_ENABLED
+                            case SDLK_F9:
+                                // dump the recent frames for diagnosing stutter
+                                if (profiler::writeChromeTrace("profile_trace.json") && profiler::writeFrameHistogram("profile_frames.json")) {
+                                    std::cout << "wrote profile_trace.json and profile_frames.json\n";
+                                } else {
+                                    std::cout << "failed to write the profile\n";
+                                }
+                                break;
+#endif
+                        }
+                        break;
+                    case SDL_KEYUP:
+                        keydown[event.key.keysym.sym] = false;
+                        break;
+                    case SDL_MOUSEMOTION:
+                        if (cursorLocked) {
+                            cameraRotation -= event.motion.xrel / 250.0f;
+                            cameraVerticalRotation = math::clampf(cameraVerticalRotation - event.motion.yrel / 250.0f, -M_PI * 0.6f, M_PI * 0.6f);
+                        }
+                        break;
+                    case SDL_MOUSEBUTTONDOWN:
+                        cursorLocked = true;
+                        break;
+                }
+            }
         }
-        glm::vec3 cameraForwardProjectXZ = glm::normalize(glm::vec3(cameraForward.x, 0.0f, cameraForward.z));
-        if (keydown[SDLK_w]) cameraVelocity += cameraForwardProjectXZ * speed;
-        if (keydown[SDLK_s]) cameraVelocity -= cameraForwardProjectXZ * speed;
-        if (keydown[SDLK_a]) cameraVelocity -= cameraRight * speed;
-        if (keydown[SDLK_d]) cameraVelocity += cameraRight * speed;
-
-        // if (keydown[SDLK_SPACE]) cameraVelocity += cameraUp * speed;
-        // if (keydown[SDLK_LSHIFT]) cameraVelocity -= cameraUp * speed;
-
-        cameraVelocity.y -= modGravity * dt;
-        cameraPosition += cameraVelocity * dt;
-
-        float height = terrain.getHeight(cameraPosition.x, cameraPosition.z);
 
-        if (cameraPosition.y <= height + 2.0f) {
-            cameraVelocity.y = 0;
-            cameraPosition.y = height + 2.0f;
+        {
+            PROFILE_ZONE("camera");
+            SDL_SetRelativeMouseMode(static_cast<SDL_bool>(cursorLocked)); 
+
+            input.forward = keydown[SDLK_w];
+            input.back = keydown[SDLK_s];
+            input.left = keydown[SDLK_a];
+            input.right = keydown[SDLK_d];
+            input.rotation = cameraRotation;
+            simulation.setInput(input);
+            cameraForward = glm::vec3(-sinf(cameraRotation), sinf(cameraVerticalRotation), -cosf(cameraRotation));
+            CameraState camera = simulation.getCamera(now);
+            cameraPosition = camera.position;
+            terrain.setCameraMotion(camera.velocity, cameraForward);
+
+            if (keydown[SDLK_r] || keydown[SDLK_f] || keydown[SDLK_g]) {
+                PROFILE_ZONE("sculpt");
+                glm::vec3 target;
+                if (pickTerrain(terrain, cameraPosition, glm::normalize(cameraForward), brushReach, target)) {
+                    TerrainBrush brush;
+                    brush.mode = keydown[SDLK_r] ? TerrainBrushMode::RAISE : keydown[SDLK_f] ? TerrainBrushMode::LOWER : TerrainBrushMode::FLATTEN;
+                    brush.x = target.x;
+                    brush.z = target.z;
+                    brush.radius = brushRadius;
+                    brush.strength = brush.mode == TerrainBrushMode::FLATTEN ? dt : brushRate * dt;
+                    brush.target = target.y;
+                    terrain.edit(brush);
+                }
+            }
         }
 
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        {
+            PROFILE_ZONE("render");
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
-        int scWidth, scHeight;
-        SDL_GetWindowSize(window, &scWidth, &scHeight);
+            int scWidth, scHeight;
+            SDL_GetWindowSize(window, &scWidth, &scHeight);
 
-        glm::mat4 proj = glm::perspective(90.0f, scWidth / static_cast<float>(scHeight), 0.1f, 1000.0f);
-        glm::mat4 view = glm::lookAt(cameraPosition, cameraPosition + cameraForward, glm::vec3(0.0f, 1.0f, 0.0f));
+            glm::mat4 proj = glm::perspective(90.0f, scWidth / static_cast<float>(scHeight), 0.1f, 1000.0f);
+            glm::mat4 view = glm::lookAt(cameraPosition, cameraPosition + cameraForward, glm::vec3(0.0f, 1.0f, 0.0f));
 
         
-        glm::vec3 lightPos = cameraPosition + glm::vec3(0, 10, 0);
+            glm::vec3 lightPos = cameraPosition + glm::vec3(0, 10, 0);
 
-        terrainShader.use();
-        terrainShader.setVec3("lightPosition", lightPos);
-        terrainShader.setMatrix4("projection", proj);
-        terrainShader.setMatrix4("view", view);
-        terrainShader.setVec2("spriteSheetSize", 24, 34);
+            terrainShader.use();
+            terrainShader.setVec3("lightPosition", lightPos);
+            terrainShader.setMatrix4("projection", proj);
+            terrainShader.setMatrix4("view", view);
         
-        objectShader.use();
-        objectShader.setVec3("lightPosition", lightPos);
-        objectShader.setMatrix4("projection", proj);
-        objectShader.setMatrix4("view", view);
-
-        terrain.render(terrainShader, objectShader, cameraPosition.x, cameraPosition.z);
-
-        // skybox
-        glm::mat4 model(1.0f);
-        model = glm::translate(model, cameraPosition);
-        model = glm::scale(model, glm::vec3(250.0f, 250.0f, 250.0f));
-        objectShader.setMatrix4("model", model);
-        textures::GALAXY->bind();
-        meshes::CUBE->render();
-
-        // water
-        waterShader.use();
-        waterShader.setMatrix4("projection", proj);
-        waterShader.setMatrix4("view", view);
-        int waterSize = 200;
-        waterShader.setMatrix4("model", glm::scale(
-            glm::translate(
-            glm::mat4(1.0f),
-            glm::vec3(cameraPosition.x - waterSize / 2, 0, cameraPosition.z - waterSize / 2)), 
-            glm::vec3(waterSize, 1, waterSize)
-        ));
-
-        waterShader.setFloat("t", currTime);
-        meshes::PLANE->render();
-
-        SDL_GL_SwapWindow(window);
+            instancedShader.use();
+            instancedShader.setVec3("lightPosition", lightPos);
+            instancedShader.setMatrix4("projection", proj);
+            instancedShader.setMatrix4("view", view);
+
+            terrain.render(terrainShader, instancedShader, cameraPosition.x, cameraPosition.z, Frustum(proj * view));
+
+            // skybox
+            objectShader.use();
+            objectShader.setVec3("lightPosition", lightPos);
+            objectShader.setMatrix4("projection", proj);
+            objectShader.setMatrix4("view", view);
+            glm::mat4 model(1.0f);
+            model = glm::translate(model, cameraPosition);
+            model = glm::scale(model, glm::vec3(250.0f, 250.0f, 250.0f));
+            objectShader.setMatrix4("model", model);
+            textures::GALAXY->bind();
+            meshes::CUBE->render();
+
+            // water
+            waterShader.use();
+            waterShader.setMatrix4("projection", proj);
+            waterShader.setMatrix4("view", view);
+            int waterSize = 200;
+            waterShader.setMatrix4("model", glm::scale(
+                glm::translate(
+                glm::mat4(1.0f),
+                glm::vec3(cameraPosition.x - waterSize / 2, 0, cameraPosition.z - waterSize / 2)), 
+                glm::vec3(waterSize, 1, waterSize)
+            ));
+
+            waterShader.setFloat("t", currTime);
+            meshes::PLANE->render();
+        }
+
+        {
+            PROFILE_ZONE("swap");
+            SDL_GL_SwapWindow(window);
+        }
     }
 
     SDL_Quit();
@@ -211,10 +342,10 @@ int program() {
 #ifdef _WIN32
 #include <windows.h>
 int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
-    return program();    
+    return program(__argc, __argv);    
 }
 #else
-int main() {
-    return program();
+int main(int argc, char** argv) {
+    return program(argc, argv);
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,165 @@
+// Checks the batched Perlin noise kernels against math::getPerlinNoise, one sample at a time:
+//  - math::getPerlinNoiseGrid at the scalar, SSE4.1 and AVX2 levels and the dispatched default
+//  - math::getPerlinNoisePoints at the same levels
+//  - math::getPerlinNoiseGridShared
+// Levels the CPU lacks are reported and skipped. Exits non-zero on a mismatch.
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Math.h"
+
+#define NOISE_TEST_TOLERANCE 1e-5f // Largest difference allowed from getPerlinNoise, noise is in [-1, 1].
+#define NOISE_TEST_PADDING 3 // Untouched floats after each output, a kernel writing past its end shows up as a mismatch.
+#define NOISE_TEST_MAX_LANES 8 // Widest SIMD register in floats, point runs are tried at every length up to twice this.
+
+struct GridCase {
+    std::string name;
+    float x0, y0, dx, dy;
+    int nx, ny;
+    unsigned int seed;
+};
+
+// Compares actual to expected, returns false and prints the worst sample if they differ
+// by more than the tolerance. where(k) describes sample k.
+template <typename Where>
+static bool compare(const std::vector<float>& expected, const std::vector<float>& actual, const std::string& name, Where where) {
+    float worst = 0;
+    size_t worstIndex = 0;
+    for (size_t k = 0; k < expected.size(); k++) {
+        float error = std::abs(expected[k] - actual[k]);
+        // NaN compares false, so test for the good case
+        if (!(error <= worst)) {
+            worst = std::isnan(error) ? INFINITY : error;
+            worstIndex = k;
+        }
+    }
+    if (worst <= NOISE_TEST_TOLERANCE) {
+        return true;
+    }
+    std::cout << "FAIL " << name << ": " << where(worstIndex) << " is " << actual[worstIndex]
+              << ", getPerlinNoise gives " << expected[worstIndex] << "\n";
+    return false;
+}
+
+// getPerlinNoise over a grid laid out like getPerlinNoiseGrid with a padded stride,
+// the padding left at 7 which no kernel should write
+static std::vector<float> referenceGrid(const GridCase& grid, size_t stride) {
+    std::vector<float> result(grid.nx * stride, 7.0f);
+    for (int i = 0; i < grid.nx; i++) {
+        float x = grid.x0 + static_cast<float>(i) * grid.dx;
+        for (int j = 0; j < grid.ny; j++) {
+            result[i * stride + j] = math::getPerlinNoise(x, grid.y0 + static_cast<float>(j) * grid.dy, grid.seed);
+        }
+    }
+    return result;
+}
+
+// Runs one grid through getPerlinNoiseGrid at level, or getPerlinNoiseGridShared if shared is set.
+static bool checkGrid(const GridCase& grid, math::SimdLevel level, bool shared) {
+    const size_t stride = grid.ny + NOISE_TEST_PADDING;
+    std::vector<float> expected = referenceGrid(grid, stride), actual(grid.nx * stride, 7.0f);
+    if (shared) {
+        math::getPerlinNoiseGridShared(actual.data(), stride, grid.x0, grid.y0, grid.dx, grid.dy, grid.nx, grid.ny, grid.seed);
+    } else {
+        math::getPerlinNoiseGrid(actual.data(), stride, grid.x0, grid.y0, grid.dx, grid.dy, grid.nx, grid.ny, grid.seed, level);
+    }
+    std::string name = std::string(shared ? "shared" : math::getSimdLevelName(level)) + " grid " + grid.name;
+    return compare(expected, actual, name, [&](size_t k) {
+        int i = static_cast<int>(k / stride), j = static_cast<int>(k % stride);
+        return "sample (" + std::to_string(i) + ", " + std::to_string(j) + ") at ("
+             + std::to_string(grid.x0 + i * grid.dx) + ", " + std::to_string(grid.y0 + j * grid.dy) + ")";
+    });
+}
+
+// Runs the first n samples of a grid, in row order, through getPerlinNoisePoints at level.
+static bool checkPoints(const GridCase& grid, int n, math::SimdLevel level) {
+    std::vector<float> xs, ys;
+    for (int i = 0; i < grid.nx && static_cast<int>(xs.size()) < n; i++) {
+        for (int j = 0; j < grid.ny && static_cast<int>(xs.size()) < n; j++) {
+            xs.push_back(grid.x0 + static_cast<float>(i) * grid.dx);
+            ys.push_back(grid.y0 + static_cast<float>(j) * grid.dy);
+        }
+    }
+    n = static_cast<int>(xs.size());
+    std::vector<float> expected(n + NOISE_TEST_PADDING, 7.0f), actual(n + NOISE_TEST_PADDING, 7.0f);
+    for (int k = 0; k < n; k++) {
+        expected[k] = math::getPerlinNoise(xs[k], ys[k], grid.seed);
+    }
+    math::getPerlinNoisePoints(actual.data(), xs.data(), ys.data(), n, grid.seed, level);
+    std::string name = std::string(math::getSimdLevelName(level)) + " points " + grid.name + " (" + std::to_string(n) + ")";
+    return compare(expected, actual, name, [&](size_t k) {
+        if (static_cast<int>(k) >= n) {
+            return "padding " + std::to_string(k - n);
+        }
+        return "point " + std::to_string(k) + " at (" + std::to_string(xs[k]) + ", " + std::to_string(ys[k]) + ")";
+    });
+}
+
+int main() {
+    std::vector<GridCase> grids = {
+        // the layout terraingen uses for a cell, several samples per lattice square
+        {"cell", 64.0f, -32.0f, 0.03125f, 0.03125f, 33, 33, 3284},
+        // every sample exactly on a lattice point, where the noise is zero
+        {"lattice points", -16.0f, -16.0f, 1.0f, 1.0f, 32, 32, 1},
+        // samples straddling zero and negative lattice lines
+        {"negative", -3.0f, -2.5f, 0.25f, 0.125f, 24, 40, 7},
+        {"just below lattice lines", -1.0f - 1e-4f, 2.0f - 1e-4f, 1.0f, 1.0f, 8, 8, 11},
+        // rows shorter than a SIMD register and with a tail after the full registers
+        {"short rows", 0.3f, 0.7f, 0.5f, 0.5f, 5, 1, 2},
+        {"tail", 0.3f, 0.7f, 0.5f, 0.5f, 5, 13, 2},
+        // far from the origin, where float precision is coarse
+        {"large positive", 1048576.0f, 2097152.0f, 0.25f, 0.25f, 16, 21, 5},
+        {"large negative", -1048576.0f, -524288.5f, 0.5f, 0.25f, 16, 21, 5},
+        {"descending", 10.0f, 10.0f, -0.75f, -0.3f, 12, 17, 9},
+    };
+    // random grids over a wide range, fixed seed so failures repeat
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<float> origin(-100000.0f, 100000.0f), step(-2.0f, 2.0f);
+    std::uniform_int_distribution<int> size(1, 40);
+    for (int n = 0; n < 200; n++) {
+        grids.push_back({"random " + std::to_string(n), origin(rng), origin(rng), step(rng), step(rng), size(rng), size(rng), static_cast<unsigned int>(rng())});
+    }
+
+    int failures = 0;
+    for (math::SimdLevel level : {math::SimdLevel::SCALAR, math::SimdLevel::SSE4, math::SimdLevel::AVX2}) {
+        if (level > math::getSimdLevel()) {
+            std::cout << "skipped " << math::getSimdLevelName(level) << ", not supported by this CPU\n";
+            continue;
+        }
+        int gridFailures = 0, pointFailures = 0, pointRuns = 0;
+        for (const GridCase& grid : grids) {
+            gridFailures += checkGrid(grid, level, false) ? 0 : 1;
+            pointFailures += checkPoints(grid, grid.nx * grid.ny, level) ? 0 : 1;
+            pointRuns++;
+        }
+        // runs shorter than, equal to and just past the register widths, over the hard cases
+        for (int g = 0; g < 4; g++) {
+            for (int n = 1; n <= 2 * NOISE_TEST_MAX_LANES + 1; n++) {
+                pointFailures += checkPoints(grids[g], n, level) ? 0 : 1;
+                pointRuns++;
+            }
+        }
+        std::cout << math::getSimdLevelName(level) << ": " << grids.size() - gridFailures << "/" << grids.size() << " grids, "
+                  << pointRuns - pointFailures << "/" << pointRuns << " point runs match\n";
+        failures += gridFailures + pointFailures;
+    }
+    // the level the default overloads dispatch to
+    int defaultFailures = 0;
+    for (const GridCase& grid : grids) {
+        defaultFailures += checkGrid(grid, math::getSimdLevel(), false) ? 0 : 1;
+        defaultFailures += checkPoints(grid, grid.nx * grid.ny, math::getSimdLevel()) ? 0 : 1;
+    }
+    failures += defaultFailures;
+    int sharedFailures = 0;
+    for (const GridCase& grid : grids) {
+        sharedFailures += checkGrid(grid, math::SimdLevel::SCALAR, true) ? 0 : 1;
+    }
+    std::cout << "shared: " << grids.size() - sharedFailures << "/" << grids.size() << " grids match\n";
+    failures += sharedFailures;
+    return failures == 0 ? 0 : 1;
+}